@@ -19,6 +19,7 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/fileutl.h>
+#include <apt-pkg/profile.h>
 
 // CNC:2002-07-03
 #include <apt-pkg/repository.h>
@@ -40,6 +41,12 @@ using namespace std;
 
 using std::string;
 
+// Options read for every item queued or finished
+static Configuration::Handle VerboseOpt("Acquire::Verbose");
+static Configuration::Handle ListsOpt("Dir::State::lists");
+static Configuration::Handle ArchivesOpt("Dir::Cache::Archives");
+static Configuration::Handle RetriesOpt("Acquire::Retries");
+
 // CNC:2002-07-03
 // VerifyChecksums - Verify file checksum	   		/*{{{*/
 // ---------------------------------------------------------------------
@@ -57,7 +64,7 @@ bool VerifyChecksums(string File,unsigned long Size,string ExpectHash, string me
    // rely on checksum
    if (Size > 0 && (unsigned long)Buf.st_size != Size)
    {
-      if (_config->FindB("Acquire::Verbose", false) == true)
+      if (VerboseOpt.FindB(false) == true)
 	 cout << "Size of "<<File<<" did not match what's in the checksum list and was redownloaded."<<endl;
       return false;
    }
@@ -69,7 +76,7 @@ bool VerifyChecksums(string File,unsigned long Size,string ExpectHash, string me
 	 
       hash.AddFD(F.Fd(), F.Size());
       if (hash.Result() != ExpectHash) {
-	 if (_config->FindB("Acquire::Verbose", false) == true)
+	 if (VerboseOpt.FindB(false) == true)
 	    cout << method << " of "<<File<<" did not match what's in the checksum list and was redownloaded."<<endl;
 	 return false;
       }
@@ -145,8 +152,11 @@ void pkgAcquire::Item::Done(string Message,off_t Size,string,
    string FileName = LookupTag(Message,"Filename");
    if (Complete == false && FileName == DestFile)
    {
+      unsigned long Resume = atoi(LookupTag(Message,"Resume-Point","0").c_str());
       if (Owner->Log != 0)
-	 Owner->Log->Fetched(Size,atoi(LookupTag(Message,"Resume-Point","0").c_str()));
+	 Owner->Log->Fetched(Size,Resume);
+      if (Size > (off_t)Resume)
+	 Profile::Count(Profile::BytesFetched,Size - Resume);
    }
 
    if (FileSize == 0)
@@ -186,7 +196,7 @@ pkgAcqIndex::pkgAcqIndex(pkgAcquire *Owner,pkgRepository *Repository,
    Decompression = false;
    Erase = false;
    
-   DestFile = _config->FindDir("Dir::State::lists") + "partial/";
+   DestFile = ListsOpt.FindDir() + "partial/";
    DestFile += URItoFileName(URI);
 
    // Create the item
@@ -217,7 +227,7 @@ pkgAcqIndex::pkgAcqIndex(pkgAcquire *Owner,pkgRepository *Repository,
 			       RealURI.c_str());
 	 }
 
-	 string FinalFile = _config->FindDir("Dir::State::lists");
+	 string FinalFile = ListsOpt.FindDir();
 	 FinalFile += URItoFileName(RealURI);
 
 	 if (VerifyChecksums(FinalFile,Size,Hash,HashType) == false)
@@ -242,7 +252,7 @@ pkgAcqIndex::pkgAcqIndex(pkgAcquire *Owner,pkgRepository *Repository,
 /* The only header we use is the last-modified header. */
 string pkgAcqIndex::Custom600Headers()
 {
-   string Final = _config->FindDir("Dir::State::lists");
+   string Final = ListsOpt.FindDir();
    Final += URItoFileName(RealURI);
    
    struct stat Buf;
@@ -282,7 +292,7 @@ void pkgAcqIndex::Done(string Message,off_t Size,string AcqHash,
 	    Status = StatError;
 	    ErrorText = _("Size mismatch");
 	    Rename(DestFile,DestFile + ".FAILED");
-	    if (_config->FindB("Acquire::Verbose",false) == true) 
+	    if (VerboseOpt.FindB(false) == true) 
 	       _error->Warning("Size mismatch of index file %s: %lu was supposed to be %lu",
 			       RealURI.c_str(), Size, FSize);
 	    return;
@@ -293,7 +303,7 @@ void pkgAcqIndex::Done(string Message,off_t Size,string AcqHash,
 	    Status = StatError;
 	    ErrorText = _("Checksum mismatch");
 	    Rename(DestFile,DestFile + ".FAILED");
-	    if (_config->FindB("Acquire::Verbose",false) == true) 
+	    if (VerboseOpt.FindB(false) == true) 
 	       _error->Warning("Checksum mismatch of index file %s: %s was supposed to be %s",
 			       RealURI.c_str(), AcqHash.c_str(), Hash.c_str());
 	    return;
@@ -306,14 +316,14 @@ void pkgAcqIndex::Done(string Message,off_t Size,string AcqHash,
       }
 	 
       // Done, move it into position
-      string FinalFile = _config->FindDir("Dir::State::lists");
+      string FinalFile = ListsOpt.FindDir();
       FinalFile += URItoFileName(RealURI);
       Rename(DestFile,FinalFile);
       chmod(FinalFile.c_str(),0644);
       
       /* We restore the original name to DestFile so that the clean operation
          will work OK */
-      DestFile = _config->FindDir("Dir::State::lists") + "partial/";
+      DestFile = ListsOpt.FindDir() + "partial/";
       DestFile += URItoFileName(RealURI);
       
       // Remove the compressed version.
@@ -390,7 +400,7 @@ pkgAcqIndexRel::pkgAcqIndexRel(pkgAcquire *Owner,pkgRepository *Repository,
    Authentication = false;
    Erase = false;
 
-   DestFile = _config->FindDir("Dir::State::lists") + "partial/";
+   DestFile = ListsOpt.FindDir() + "partial/";
    DestFile += URItoFileName(URI);
    
    // Create the item
@@ -418,7 +428,7 @@ pkgAcqIndexRel::pkgAcqIndexRel(pkgAcquire *Owner,pkgRepository *Repository,
 			       RealURI.c_str());
 	 }
 
-	 string FinalFile = _config->FindDir("Dir::State::lists");
+	 string FinalFile = ListsOpt.FindDir();
 	 FinalFile += URItoFileName(RealURI);
 
 	 if (VerifyChecksums(FinalFile,Size,Hash,HashType) == false)
@@ -443,7 +453,7 @@ pkgAcqIndexRel::pkgAcqIndexRel(pkgAcquire *Owner,pkgRepository *Repository,
 /* The only header we use is the last-modified header. */
 string pkgAcqIndexRel::Custom600Headers()
 {
-   string Final = _config->FindDir("Dir::State::lists");
+   string Final = ListsOpt.FindDir();
    Final += URItoFileName(RealURI);
    
    struct stat Buf;
@@ -507,14 +517,14 @@ void pkgAcqIndexRel::Done(string Message,off_t Size,string AcqHash,
       }
 
       // Done, move it into position
-      string FinalFile = _config->FindDir("Dir::State::lists");
+      string FinalFile = ListsOpt.FindDir();
       FinalFile += URItoFileName(RealURI);
       Rename(DestFile,FinalFile);
       chmod(FinalFile.c_str(),0644);
 
       /* We restore the original name to DestFile so that the clean operation
          will work OK */
-      DestFile = _config->FindDir("Dir::State::lists") + "partial/";
+      DestFile = ListsOpt.FindDir() + "partial/";
       DestFile += URItoFileName(RealURI);
       
       // Remove the compressed version.
@@ -550,7 +560,7 @@ void pkgAcqIndexRel::Done(string Message,off_t Size,string AcqHash,
       if (Master == true)
       {
 	 // We've got a LocalOnly IMS
-	 string FinalFile = _config->FindDir("Dir::State::lists");
+	 string FinalFile = ListsOpt.FindDir();
 	 FinalFile += URItoFileName(RealURI);
 	 Repository->ParseRelease(FinalFile);
       }
@@ -577,7 +587,7 @@ void pkgAcqIndexRel::Done(string Message,off_t Size,string AcqHash,
 	 Status = StatError;
 	 ErrorText = _("Size mismatch");
 	 Rename(DestFile,DestFile + ".FAILED");
-	 if (_config->FindB("Acquire::Verbose",false) == true) 
+	 if (VerboseOpt.FindB(false) == true) 
 	    _error->Warning("Size mismatch of index file %s: %lu was supposed to be %lu",
 			    RealURI.c_str(), Size, FSize);
 	 return;
@@ -587,7 +597,7 @@ void pkgAcqIndexRel::Done(string Message,off_t Size,string AcqHash,
 	 Status = StatError;
 	 ErrorText = _("Checksum mismatch");
 	 Rename(DestFile,DestFile + ".FAILED");
-	 if (_config->FindB("Acquire::Verbose",false) == true) 
+	 if (VerboseOpt.FindB(false) == true) 
 	    _error->Warning("Checksum mismatch of index file %s: %s was supposed to be %s",
 			    RealURI.c_str(), AcqHash.c_str(), Hash.c_str());
 	 return;
@@ -597,7 +607,7 @@ void pkgAcqIndexRel::Done(string Message,off_t Size,string AcqHash,
    if (Master == false || Repository->IsAuthenticated() == false)
    {
       // Done, move it into position
-      string FinalFile = _config->FindDir("Dir::State::lists");
+      string FinalFile = ListsOpt.FindDir();
       FinalFile += URItoFileName(RealURI);
       Rename(DestFile,FinalFile);
       chmod(FinalFile.c_str(),0644);
@@ -655,7 +665,7 @@ pkgAcqArchive::pkgAcqArchive(pkgAcquire *Owner,pkgSourceList *Sources,
                Item(Owner), Version(Version), Sources(Sources), Recs(Recs), 
                StoreFilename(StoreFilename), Vf(Version.FileList())
 {
-   Retries = _config->FindI("Acquire::Retries",0);
+   Retries = RetriesOpt.FindI(0);
 
    if (Version.Arch() == 0)
    {
@@ -737,7 +747,7 @@ bool pkgAcqArchive::QueueNext()
 
       // See if we already have the file. (Legacy filenames)
       FileSize = Version->Size;
-      string FinalFile = _config->FindDir("Dir::Cache::Archives") + flNotDir(PkgFile);
+      string FinalFile = ArchivesOpt.FindDir() + flNotDir(PkgFile);
       struct stat Buf;
       if (stat(FinalFile.c_str(),&Buf) == 0)
       {
@@ -757,7 +767,7 @@ bool pkgAcqArchive::QueueNext()
       }
 
       // Check it again using the new style output filenames
-      FinalFile = _config->FindDir("Dir::Cache::Archives") + flNotDir(StoreFilename);
+      FinalFile = ArchivesOpt.FindDir() + flNotDir(StoreFilename);
       if (stat(FinalFile.c_str(),&Buf) == 0)
       {
 	 // Make sure the size matches
@@ -775,7 +785,7 @@ bool pkgAcqArchive::QueueNext()
 	 unlink(FinalFile.c_str());
       }
 
-      DestFile = _config->FindDir("Dir::Cache::Archives") + "partial/" + flNotDir(StoreFilename);
+      DestFile = ArchivesOpt.FindDir() + "partial/" + flNotDir(StoreFilename);
       
       // Check the destination file
       if (stat(DestFile.c_str(),&Buf) == 0)
@@ -795,6 +805,18 @@ bool pkgAcqArchive::QueueNext()
       Desc.ShortDesc = Version.ParentPkg().Name();
       QueueURI(Desc);
 
+      /* Offer it to the whole mirror set at once, whichever mirror asks
+         first gets it */
+      vector<string> Mirrors;
+      Sources->GetMirrors(Desc.URI,Mirrors);
+      for (vector<string>::const_iterator I = Mirrors.begin();
+	   I != Mirrors.end(); I++)
+      {
+	 pkgAcquire::ItemDesc Alt = Desc;
+	 Alt.URI = *I;
+	 QueueURI(Alt);
+      }
+
       Vf++;
       return true;
    }
@@ -828,6 +850,17 @@ static void ScriptsAcquireDone(const char *ConfKey,
 									/*}}}*/
 #endif
 
+// AcqArchive::Custom600Headers - Insert custom request headers		/*{{{*/
+// ---------------------------------------------------------------------
+/* The archive size is known from the package index, passing it on lets
+   the method decide how to fetch the file before the server replies. */
+string pkgAcqArchive::Custom600Headers()
+{
+   char S[100];
+   snprintf(S,sizeof(S),"\nExpected-Size: %lu",(unsigned long)Version->Size);
+   return S;
+}
+									/*}}}*/
 // AcqArchive::Done - Finished fetching					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -883,7 +916,7 @@ void pkgAcqArchive::Done(string Message,off_t Size,string AcqHash,
    }
    
    // Done, move it into position
-   string FinalFile = _config->FindDir("Dir::Cache::Archives");
+   string FinalFile = ArchivesOpt.FindDir();
    FinalFile += flNotDir(StoreFilename);
    Rename(DestFile,FinalFile);
    
@@ -917,6 +950,14 @@ void pkgAcqArchive::Failed(string Message,pkgAcquire::MethodConfig *Cnf)
       Item::Failed(Message,Cnf);
       return;
    }
+
+   // Still queued on another mirror of the set, let it have a go
+   if (QueueCounter != 0)
+   {
+      Status = StatIdle;
+      Bump();
+      return;
+   }
    
    if (QueueNext() == false)
    {
@@ -956,7 +997,7 @@ pkgAcqFile::pkgAcqFile(pkgAcquire *Owner,string URI,
 		       unsigned long Size,string Dsc,string ShortDesc) :
                        Item(Owner)
 {
-   Retries = _config->FindI("Acquire::Retries",0);
+   Retries = RetriesOpt.FindI(0);
    
    DestFile = flNotDir(URI);
    Hash = ExpectHash;
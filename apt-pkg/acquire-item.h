@@ -36,6 +36,7 @@ class pkgAcquire::Item
    inline void QueueURI(ItemDesc &Item)
                  {Owner->Enqueue(Item);}
    inline void Dequeue() {Owner->Dequeue(this);}
+   inline void Bump() {Owner->Bump();}
    
    // Safe rename function with timestamp preservation
    void Rename(string From,string To);
@@ -158,6 +159,7 @@ class pkgAcqArchive : public pkgAcquire::Item
    virtual void Failed(string Message,pkgAcquire::MethodConfig *Cnf);
    virtual void Done(string Message,off_t Size,string AcqHash,
 		     pkgAcquire::MethodConfig *Cnf);
+   virtual string Custom600Headers();
    virtual string DescURI() {return Desc.URI;}
    virtual void Finished();
 
@@ -0,0 +1,167 @@
+// -*- mode: c++; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Local Acquire Methods - The file and copy methods
+
+   The file method simply checks that the file specified exists, if so
+   the relevent information is returned. If a compressed filename is
+   specified then the file name without the extension will also be
+   checked and information about it will be returned in Alt-*
+
+   The copy method takes a uri like a file: uri and copies it to the
+   destination file. The copy is left to the kernel (see CopyFile) and
+   the file is only hashed when APT asked for a checksum.
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <apt-pkg/acquire-local.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/error.h>
+#include <apt-pkg/hashes.h>
+#include <apt-pkg/mmap.h>
+
+#include <sys/stat.h>
+#include <utime.h>
+#include <unistd.h>
+
+#include <apti18n.h>
+									/*}}}*/
+
+// FileMethod::Fetch - Fetch a file					/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool pkgAcqFileMethod::Fetch(FetchItem *Itm)
+{
+   URI Get = Itm->Uri;
+   string File = Get.Path;
+   FetchResult Res;
+   if (Get.Host.empty() == false)
+      return _error->Error(_("Invalid URI, local URIS must not start with //"));
+
+   // See if the file exists
+   struct stat Buf;
+   if (stat(File.c_str(),&Buf) == 0)
+   {
+      Res.Size = Buf.st_size;
+      Res.Filename = File;
+      Res.LastModified = Buf.st_mtime;
+      Res.IMSHit = false;
+      if (Itm->LastModified == Buf.st_mtime && Itm->LastModified != 0)
+	 Res.IMSHit = true;
+   }
+
+   // CNC:2003-11-04
+   // See if we can compute a file without a .gz/.bz2/etc extension
+   string ComprExtension = _config->Find("Acquire::ComprExtension", ".bz2");
+   string::size_type Pos = File.rfind(ComprExtension);
+   if (Pos + ComprExtension.length() == File.length())
+   {
+      File = string(File,0,Pos);
+      if (stat(File.c_str(),&Buf) == 0)
+      {
+	 FetchResult AltRes;
+	 AltRes.Size = Buf.st_size;
+	 AltRes.Filename = File;
+	 AltRes.LastModified = Buf.st_mtime;
+	 AltRes.IMSHit = false;
+	 if (Itm->LastModified == Buf.st_mtime && Itm->LastModified != 0)
+	    AltRes.IMSHit = true;
+
+	 URIDone(Res,&AltRes);
+	 return true;
+      }
+   }
+
+   if (Res.Filename.empty() == true)
+      return _error->Error(_("File not found"));
+
+   URIDone(Res);
+   return true;
+}
+									/*}}}*/
+// CopyMethod::Fetch - Fetch a file					/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+bool pkgAcqCopyMethod::Fetch(FetchItem *Itm)
+{
+   URI Get = Itm->Uri;
+   string File = Get.Path;
+
+   // Stat the file and send a start message
+   struct stat Buf;
+   if (stat(File.c_str(),&Buf) != 0)
+      return _error->Errno("stat",_("Failed to stat"));
+
+   // Forumulate a result and send a start message
+   FetchResult Res;
+   Res.Size = Buf.st_size;
+   Res.Filename = Itm->DestFile;
+   Res.LastModified = Buf.st_mtime;
+   Res.IMSHit = false;
+   URIStart(Res);
+
+   // See if the file exists
+   FileFd From(File,FileFd::ReadOnly);
+   FileFd To(Itm->DestFile,FileFd::WriteEmpty);
+   To.EraseOnFailure();
+   if (_error->PendingError() == true)
+   {
+      To.OpFail();
+      return false;
+   }
+
+   // Copy the file
+   if (CopyFile(From,To) == false)
+   {
+      To.OpFail();
+      return false;
+   }
+
+   // Hash the source in one pass over a map of it
+   if (Itm->ChecksumType.empty() == false)
+   {
+      Hashes Hash;
+      if (Buf.st_size != 0)
+      {
+	 MMap Map(From,MMap::ReadOnly);
+	 if (_error->PendingError() == true)
+	 {
+	    To.OpFail();
+	    return false;
+	 }
+	 Hash.Add((unsigned char *)Map.Data(),Map.Size());
+      }
+      Res.TakeHashes(Hash);
+   }
+
+   From.Close();
+   To.Close();
+
+   // Transfer the modification times
+   struct utimbuf TimeBuf;
+   TimeBuf.actime = Buf.st_atime;
+   TimeBuf.modtime = Buf.st_mtime;
+   if (utime(Itm->DestFile.c_str(),&TimeBuf) != 0)
+   {
+      To.OpFail();
+      return _error->Errno("utime",_("Failed to set modification time"));
+   }
+
+   URIDone(Res);
+   return true;
+}
+									/*}}}*/
+// MakeLocalMethod - Create an in-process method			/*{{{*/
+// ---------------------------------------------------------------------
+/* Returns 0 if the access type has no in-process implementation */
+pkgAcqMethod *pkgMakeLocalMethod(string Access,int InFd,int OutFd)
+{
+   if (Access == "file")
+      return new pkgAcqFileMethod(InFd,OutFd);
+   if (Access == "copy")
+      return new pkgAcqCopyMethod(InFd,OutFd);
+   return 0;
+}
+									/*}}}*/
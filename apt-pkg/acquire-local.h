@@ -0,0 +1,42 @@
+// -*- mode: c++; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Local Acquire Methods - The file and copy methods
+
+   These methods only look at the local file system. Besides being the
+   core of the file and copy method programs they can be run by APT on a
+   thread of its own, which saves the process startup for every queue
+   of a local or NFS mounted repository.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PKGLIB_ACQUIRE_LOCAL_H
+#define PKGLIB_ACQUIRE_LOCAL_H
+
+#include <apt-pkg/acquire-method.h>
+
+class pkgAcqFileMethod : public pkgAcqMethod
+{
+   virtual bool Fetch(FetchItem *Itm);
+
+   public:
+
+   pkgAcqFileMethod(int InFd = STDIN_FILENO,int OutFd = STDOUT_FILENO) :
+        pkgAcqMethod("1.0",SingleInstance | LocalOnly,InFd,OutFd) {}
+};
+
+class pkgAcqCopyMethod : public pkgAcqMethod
+{
+   virtual bool Fetch(FetchItem *Itm);
+
+   public:
+
+   pkgAcqCopyMethod(int InFd = STDIN_FILENO,int OutFd = STDOUT_FILENO) :
+        pkgAcqMethod("1.0",SingleInstance,InFd,OutFd) {}
+};
+
+// Create the method for an access type talking over the given FDs
+pkgAcqMethod *pkgMakeLocalMethod(string Access,int InFd,int OutFd);
+
+#endif
@@ -26,6 +26,7 @@
 #include <sstream>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 									/*}}}*/
 
@@ -34,8 +35,10 @@ using namespace std;
 // AcqMethod::pkgAcqMethod - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
 /* This constructs the initialization text */
-pkgAcqMethod::pkgAcqMethod(const char *Ver,unsigned long Flags)
-	: Flags(Flags) // CNC:2002-07-11
+pkgAcqMethod::pkgAcqMethod(const char *Ver,unsigned long Flags,
+			   int InFd,int OutFd)
+	: Flags(Flags), InFd(InFd), OutFd(OutFd), // CNC:2002-07-11
+          Broken(false)
 {
    char S[300] = "";
    char *End = S;
@@ -63,12 +66,15 @@ pkgAcqMethod::pkgAcqMethod(const char *Ver,unsigned long Flags)
    // CNC:2004-04-27
    if ((Flags & HasPreferredURI) == HasPreferredURI)
       strcat(End,"Has-Preferred-URI: true\n");
+
+   // We take framed messages and answer with them once APT sends one
+   strcat(End,"Framed: true\n");
    strcat(End,"\n");
 
-   if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-      exit(100);
+   Framed = false;
+   SendMessage(S);
 
-   SetNonBlock(STDIN_FILENO,true);
+   SetNonBlock(InFd,true);
 
    Queue = 0;
    QueueBack = 0;
@@ -125,8 +131,7 @@ void pkgAcqMethod::Fail(string Err,bool Transient)
    else
       strcat(S,"\n");
    
-   if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-      exit(100);
+   SendMessage(S);
 }
 									/*}}}*/
 // AcqMethod::URIStart - Indicate a download is starting		/*{{{*/
@@ -151,8 +156,7 @@ void pkgAcqMethod::URIStart(FetchResult &Res)
 
    s << "\n";
    string S = s.str();
-   if (write(STDOUT_FILENO,S.c_str(),S.size()) != (ssize_t)S.size())
-      exit(100);
+   SendMessage(S);
 }
 									/*}}}*/
 // AcqMethod::URIDone - A URI is finished				/*{{{*/
@@ -211,8 +215,7 @@ void pkgAcqMethod::URIDone(FetchResult &Res, FetchResult *Alt)
    
    s << "\n";
    string S = s.str();
-   if (write(STDOUT_FILENO,S.c_str(),S.size()) != (ssize_t)S.size())
-      exit(100);
+   SendMessage(S);
 
    // Dequeue
    FetchItem *Tmp = Queue;
@@ -232,23 +235,22 @@ bool pkgAcqMethod::MediaFail(string Required,string Drive)
    snprintf(S,sizeof(S),"403 Media Failure\nMedia: %s\nDrive: %s\n\n",
 	    Required.c_str(),Drive.c_str());
 
-   if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-      exit(100);
+   SendMessage(S);
    
-   vector<string> MyMessages;
+   deque<string> MyMessages;
    
    /* Here we read messages until we find a 603, each non 603 message is
       appended to the main message list for later processing */
    while (1)
    {
-      if (WaitFd(STDIN_FILENO) == false)
+      if (WaitFd(InFd) == false)
 	 return false;
       
-      if (ReadMessages(STDIN_FILENO,MyMessages) == false)
+      if (ReadMessages(InFd,MyMessages,&Framed) == false)
 	 return false;
 
       string Message = MyMessages.front();
-      MyMessages.erase(MyMessages.begin());
+      MyMessages.pop_front();
       
       // Fetch the message number
       char *End;
@@ -256,7 +258,8 @@ bool pkgAcqMethod::MediaFail(string Required,string Drive)
       if (End == Message.c_str())
       {	 
 	 cerr << "Malformed message!" << endl;
-	 exit(100);
+	 ChannelBroken();
+	 return false;
       }
 
       // Change ack
@@ -265,7 +268,7 @@ bool pkgAcqMethod::MediaFail(string Required,string Drive)
 	 while (MyMessages.empty() == false)
 	 {
 	    Messages.push_back(MyMessages.front());
-	    MyMessages.erase(MyMessages.begin());
+	    MyMessages.pop_front();
 	 }
 
 	 return !StringToBool(LookupTag(Message,"Fail"),false);
@@ -285,23 +288,22 @@ bool pkgAcqMethod::NeedAuth(string Description,string &User,string &Pass)
    snprintf(S,sizeof(S),"404 Authenticate\nDescription: %s\n\n",
 	    Description.c_str());
 
-   if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-      exit(100);
+   SendMessage(S);
    
-   vector<string> MyMessages;
+   deque<string> MyMessages;
    
    /* Here we read messages until we find a 604, each non 604 message is
       appended to the main message list for later processing */
    while (1)
    {
-      if (WaitFd(STDIN_FILENO) == false)
+      if (WaitFd(InFd) == false)
 	 return false;
       
-      if (ReadMessages(STDIN_FILENO,MyMessages) == false)
+      if (ReadMessages(InFd,MyMessages,&Framed) == false)
 	 return false;
 
       string Message = MyMessages.front();
-      MyMessages.erase(MyMessages.begin());
+      MyMessages.pop_front();
       
       // Fetch the message number
       char *End;
@@ -309,7 +311,8 @@ bool pkgAcqMethod::NeedAuth(string Description,string &User,string &Pass)
       if (End == Message.c_str())
       {	 
 	 cerr << "Malformed message!" << endl;
-	 exit(100);
+	 ChannelBroken();
+	 return false;
       }
 
       // Change ack
@@ -318,7 +321,7 @@ bool pkgAcqMethod::NeedAuth(string Description,string &User,string &Pass)
 	 while (MyMessages.empty() == false)
 	 {
 	    Messages.push_back(MyMessages.front());
-	    MyMessages.erase(MyMessages.begin());
+	    MyMessages.pop_front();
 	 }
 
 	 if (StringToBool(LookupTag(Message,"Fail"),false) == false)
@@ -380,13 +383,16 @@ int pkgAcqMethod::Run(bool Single)
 {
    while (1)
    {
+      if (Broken == true)
+	 return 100;
+
       // Block if the message queue is empty
       if (Messages.empty() == true)
       {
 	 if (Single == false)
-	    if (WaitFd(STDIN_FILENO) == false)
+	    if (WaitFd(InFd) == false)
 	       break;
-	 if (ReadMessages(STDIN_FILENO,Messages) == false)
+	 if (ReadMessages(InFd,Messages,&Framed) == false)
 	    break;
       }
             
@@ -395,7 +401,7 @@ int pkgAcqMethod::Run(bool Single)
 	 return -1;
       
       string Message = Messages.front();
-      Messages.erase(Messages.begin());
+      Messages.pop_front();
       
       // Fetch the message number
       char *End;
@@ -422,6 +428,8 @@ int pkgAcqMethod::Run(bool Single)
 	    if (StrToTime(LookupTag(Message,"Last-Modified"),Tmp->LastModified) == false)
 	       Tmp->LastModified = 0;
 	    Tmp->IndexFile = StringToBool(LookupTag(Message,"Index-File"),false);
+	    Tmp->ExpectedSize = atol(LookupTag(Message,"Expected-Size","0").c_str());
+	    Tmp->ChecksumType = LookupTag(Message,"Checksum-Type");
 	    Tmp->Next = 0;
 
 	    // CNC:2002-07-11
@@ -449,8 +457,7 @@ int pkgAcqMethod::Run(bool Single)
 	    char S[1024];
 	    snprintf(S,sizeof(S),"179 Preferred URI\nPreferredURI: %s\n\n",
 		     PreferredURI().c_str());
-	    if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-	       exit(100);
+	    SendMessage(S);
 	    break;
 
 	 }
@@ -461,6 +468,38 @@ int pkgAcqMethod::Run(bool Single)
    return 0;
 }
 									/*}}}*/
+// AcqMethod::SendMessage - Send a message to APT			/*{{{*/
+// ---------------------------------------------------------------------
+/* Messages are framed as soon as APT has shown it understands frames */
+void pkgAcqMethod::SendMessage(const string &Message)
+{
+   if (Broken == true)
+      return;
+
+   string Frame;
+   const string *Out = &Message;
+   if (Framed == true)
+   {
+      Frame = FrameMessage(Message);
+      Out = &Frame;
+   }
+   
+   if (write(OutFd,Out->c_str(),Out->size()) != (ssize_t)Out->size())
+      ChannelBroken();
+}
+									/*}}}*/
+// AcqMethod::ChannelBroken - Give up talking to APT			/*{{{*/
+// ---------------------------------------------------------------------
+/* A method process has nobody left to talk to and exits. One running
+   in-process on a thread of APT must not take APT down with it, Run()
+   returns instead and the thread closes its pipes. */
+void pkgAcqMethod::ChannelBroken()
+{
+   if (InFd == STDIN_FILENO && OutFd == STDOUT_FILENO)
+      exit(100);
+   Broken = true;
+}
+									/*}}}*/
 // AcqMethod::Log - Send a log message					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -481,8 +520,7 @@ void pkgAcqMethod::Log(const char *Format,...)
    vsnprintf(S+Len,sizeof(S)-4-Len,Format,args);
    strcat(S,"\n\n");
    
-   if (write(STDOUT_FILENO,S,strlen(S)) != (signed)strlen(S))
-      exit(100);
+   SendMessage(S);
 }
 									/*}}}*/
 // AcqMethod::Status - Send a status message				/*{{{*/
@@ -506,8 +544,7 @@ void pkgAcqMethod::Status(const char *Format,...)
    s << Buf << "\n\n";
 
    string S = s.str();
-   if (write(STDOUT_FILENO,S.c_str(),S.size()) != (ssize_t)S.size())
-      exit(100);
+   SendMessage(S);
 }
 									/*}}}*/
 // AcqMethod::Redirect - Send a redirect message			/*{{{*/
@@ -525,8 +562,7 @@ void pkgAcqMethod::Redirect(const string &NewURI)
      << "\n\n";
 
    string S = s.str();
-   if (write(STDOUT_FILENO,S.c_str(),S.size()) != (ssize_t)S.size())
-      exit(100);
+   SendMessage(S);
 
    // Change the URI for the request.
    Queue->Uri = NewURI;
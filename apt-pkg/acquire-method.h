@@ -17,6 +17,8 @@
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/strutl.h>
 
+#include <unistd.h>
+
 typedef std::map<string,string> HashResults;
 
 class Hashes;
@@ -27,6 +29,10 @@ class pkgAcqMethod
    // CNC:2002-07-11
    unsigned long Flags;
 
+   // The channel to APT, stdin/stdout unless running in-process
+   int InFd;
+   int OutFd;
+
    struct FetchItem
    {
       FetchItem *Next;
@@ -35,6 +41,8 @@ class pkgAcqMethod
       string DestFile;
       time_t LastModified;
       bool IndexFile;
+      unsigned long ExpectedSize;
+      string ChecksumType;
    };
    
    struct FetchResult
@@ -53,7 +61,9 @@ class pkgAcqMethod
    };
 
    // State
-   vector<string> Messages;
+   deque<string> Messages;
+   bool Framed;
+   bool Broken;
    FetchItem *Queue;
    FetchItem *QueueBack;
    string FailExtra;
@@ -63,6 +73,8 @@ class pkgAcqMethod
    virtual bool Fetch(FetchItem * /*Item*/) {return true;}
    
    // Outgoing messages
+   void SendMessage(const string &Message);
+   void ChannelBroken();
    void Fail(bool Transient = false);
    inline void Fail(const char *Why, bool Transient = false) {Fail(string(Why),Transient);}
    void Fail(string Why, bool Transient = false);
@@ -89,7 +101,8 @@ class pkgAcqMethod
    int Run(bool Single = false);
    inline void SetFailExtraMsg(string Msg) {FailExtra = Msg;}
    
-   pkgAcqMethod(const char *Ver,unsigned long Flags = 0);
+   pkgAcqMethod(const char *Ver,unsigned long Flags = 0,
+		int InFd = STDIN_FILENO,int OutFd = STDOUT_FILENO);
    virtual ~pkgAcqMethod() {}
 };
 
@@ -14,12 +14,14 @@
 // Include Files							/*{{{*/
 #include <apt-pkg/acquire-worker.h>
 #include <apt-pkg/acquire-item.h>
+#include <apt-pkg/acquire-local.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/strutl.h>
 
 #include <apti18n.h>
+#include <config.h>
 
 #include <iostream>
 #include <fstream>
@@ -77,6 +79,12 @@ void pkgAcquire::Worker::Construct()
    OutFd = -1;
    OutReady = false;
    InReady = false;
+   Framed = false;
+   Local = 0;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_init(&Pause,0);
+#endif
+   LastProgress = 0;
    Debug = _config->FindB("Debug::pkgAcquire::Worker",false);
 }
 									/*}}}*/
@@ -85,6 +93,10 @@ void pkgAcquire::Worker::Construct()
 /* */
 pkgAcquire::Worker::~Worker()
 {
+   StopLocal();
+#ifdef HAVE_PTHREAD
+   pthread_mutex_destroy(&Pause);
+#endif
    close(InFd);
    close(OutFd);
    
@@ -100,7 +112,8 @@ pkgAcquire::Worker::~Worker()
 									/*}}}*/
 // Worker::Start - Start the worker process				/*{{{*/
 // ---------------------------------------------------------------------
-/* This forks the method and inits the communication channel */
+/* This forks the method (or starts it on a thread if it can run
+   in-process) and inits the communication channel */
 bool pkgAcquire::Worker::Start()
 {
    // Get the method path
@@ -124,7 +137,8 @@ bool pkgAcquire::Worker::Start()
       SetCloseExec(Pipes[I],true);
    
    // Fork off the process
-   Process = ExecFork();
+   if (StartLocal(Pipes[2],Pipes[1]) == false)
+      Process = ExecFork();
    if (Process == 0)
    {
       // Setup the FDs
@@ -147,10 +161,14 @@ bool pkgAcquire::Worker::Start()
    OutFd = Pipes[3];
    SetNonBlock(Pipes[0],true);
    SetNonBlock(Pipes[3],true);
-   close(Pipes[1]);
-   close(Pipes[2]);
+   if (Local == 0)
+   {
+      close(Pipes[1]);
+      close(Pipes[2]);
+   }
    OutReady = false;
    InReady = true;
+   Framed = false;
    
    // Read the configuration data
    if (WaitFd(InFd) == false ||
@@ -158,6 +176,7 @@ bool pkgAcquire::Worker::Start()
       return _error->Error(_("Method %s did not start correctly"),Method.c_str());
 
    RunMessages();
+   Framed = Config->Framed && _config->FindB("Acquire::Framed-Messages",true);
    if (OwnerQ != 0)
       SendConfiguration();
    
@@ -167,7 +186,7 @@ bool pkgAcquire::Worker::Start()
        Config->PreferredURI.empty() == true) {
       SetNonBlock(InFd,false);
       SetNonBlock(OutFd,false);
-      OutQueue += "679 Preferred URI\n\n";
+      SendMessage("679 Preferred URI\n\n");
       Config->PreferredURI = "<none>";
       if (OutFdReady() == true)
 	 while (InFdReady() == true && Config->PreferredURI == "<none>");
@@ -178,6 +197,134 @@ bool pkgAcquire::Worker::Start()
    return true;
 }
 									/*}}}*/
+// Worker::StartLocal - Run the method on a thread			/*{{{*/
+// ---------------------------------------------------------------------
+/* Methods with an in-process implementation talk to us over the same
+   pipes a child would get, so the rest of the worker does not care. */
+bool pkgAcquire::Worker::StartLocal(int In,int Out)
+{
+#ifdef HAVE_PTHREAD
+   if (_config->FindB("Acquire::In-Process",true) == false)
+      return false;
+   
+   Local = pkgMakeLocalMethod(Access,In,Out);
+   if (Local == 0)
+      return false;
+   
+   LocalFds[0] = In;
+   LocalFds[1] = Out;
+   if (pthread_create(&Thread,0,RunLocal,this) != 0)
+   {
+      delete Local;
+      Local = 0;
+      return false;
+   }
+
+   if (Debug == true)
+      clog << "Running method '" << Access << "' in-process" << endl;
+   return true;
+#else
+   return false;
+#endif
+}
+									/*}}}*/
+// Worker::RunLocal - Thread body of an in-process method		/*{{{*/
+// ---------------------------------------------------------------------
+/* Closing our end of the pipes tells the worker we are gone, just like
+   a dying child would. The messages are handled holding the pause lock,
+   see PauseLocal. */
+void *pkgAcquire::Worker::RunLocal(void *Me)
+{
+   Worker *W = (Worker *)Me;
+   while (WaitFd(W->LocalFds[0]) == true)
+   {
+      pthread_mutex_lock(&W->Pause);
+      int Res = W->Local->Run(true);
+      pthread_mutex_unlock(&W->Pause);
+      if (Res != -1)
+	 break;
+   }
+   close(W->LocalFds[0]);
+   close(W->LocalFds[1]);
+   return 0;
+}
+									/*}}}*/
+// Worker::StopLocal - Wind down an in-process method			/*{{{*/
+// ---------------------------------------------------------------------
+/* Closing its input makes the method leave Run(), whatever it still has
+   to say is drained so it can never block on a full pipe. */
+void pkgAcquire::Worker::StopLocal()
+{
+#ifdef HAVE_PTHREAD
+   if (Local == 0)
+      return;
+   
+   close(OutFd);
+   OutFd = -1;
+   SetNonBlock(InFd,false);
+   char Buf[1024];
+   int Res;
+   while ((Res = read(InFd,Buf,sizeof(Buf))) > 0 || 
+	  (Res < 0 && errno == EINTR));
+   
+   pthread_join(Thread,0);
+   delete Local;
+   Local = 0;
+#endif
+}
+									/*}}}*/
+// Worker::PauseLocal - Keep an in-process method between messages	/*{{{*/
+// ---------------------------------------------------------------------
+/* This never waits, a method that is busy may block writing to us while
+   we wait for it. False is returned if it is busy. */
+bool pkgAcquire::Worker::PauseLocal()
+{
+#ifdef HAVE_PTHREAD
+   if (Local == 0)
+      return true;
+   return pthread_mutex_trylock(&Pause) == 0;
+#else
+   return true;
+#endif
+}
+									/*}}}*/
+// Worker::ResumeLocal - Let a paused in-process method go on		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+void pkgAcquire::Worker::ResumeLocal()
+{
+#ifdef HAVE_PTHREAD
+   if (Local != 0)
+      pthread_mutex_unlock(&Pause);
+#endif
+}
+									/*}}}*/
+// Worker::Restart - Restart the method process				/*{{{*/
+// ---------------------------------------------------------------------
+/* Used to abort whatever the method is doing, the queue is responsible
+   for putting the items it was sent back into the idle state. */
+bool pkgAcquire::Worker::Restart()
+{
+   if (Process > 0)
+   {
+      kill(Process,SIGINT);
+      ExecWait(Process,Access.c_str(),true);
+   }
+   StopLocal();
+   Process = -1;
+   close(InFd);
+   close(OutFd);
+   InFd = -1;
+   OutFd = -1;
+   OutReady = false;
+   InReady = false;
+   OutQueue = string();
+   MessageQueue.clear();
+   ItemDone();
+
+   return Start();
+}
+									/*}}}*/
 // Worker::ReadMessages - Read all pending messages into the list	/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -197,7 +344,7 @@ bool pkgAcquire::Worker::RunMessages()
    while (MessageQueue.empty() == false)
    {
       string Message = MessageQueue.front();
-      MessageQueue.erase(MessageQueue.begin());
+      MessageQueue.pop_front();
 
       if (Debug == true)
 	 clog << " <- " << Access << ':' << QuoteString(Message,"\n") << endl;
@@ -266,7 +413,9 @@ bool pkgAcquire::Worker::RunMessages()
 	    CurrentSize = 0;
 	    TotalSize = atoi(LookupTag(Message,"Size","0").c_str());
 	    ResumePoint = atoi(LookupTag(Message,"Resume-Point","0").c_str());
-	    Itm->Owner->Start(Message,atoi(LookupTag(Message,"Size","0").c_str()));
+	    gettimeofday(&ItemStart,0);
+	    LastProgress = ItemStart.tv_sec;
+	    Itm->Owner->Start(Message,TotalSize);
 
 	    // Display update before completion
 	    if (Log != 0 && Log->MorePulses == true)
@@ -293,16 +442,28 @@ bool pkgAcquire::Worker::RunMessages()
 	    // Display update before completion
 	    if (Log != 0 && Log->MorePulses == true)
 	       Log->Pulse(Owner->GetOwner());
+
+	    // Account the transfer rate of the queue
+	    string SizeTag = LookupTag(Message,"Size","0");
+	    unsigned long Size = atoi(SizeTag.c_str());
+	    if (CurrentItem == Itm && Size > ResumePoint &&
+		StringToBool(LookupTag(Message,"IMS-Hit"),false) == false)
+	    {
+	       struct timeval Now;
+	       gettimeofday(&Now,0);
+	       OwnerQ->FetchedBytes += Size - ResumePoint;
+	       OwnerQ->FetchTime += Now.tv_sec - ItemStart.tv_sec +
+		                    (Now.tv_usec - ItemStart.tv_usec)/1000000.0;
+	    }
 	    
 	    OwnerQ->ItemDone(Itm);
-	    if (TotalSize != 0 &&
-		(unsigned)atoi(LookupTag(Message,"Size","0").c_str()) != TotalSize)
+	    if (TotalSize != 0 && Size != TotalSize)
 	       _error->Warning("Bizarre Error - File size is not what the server reported %s %lu",
-			       LookupTag(Message,"Size","0").c_str(),TotalSize);
+			       SizeTag.c_str(),TotalSize);
 
 	    // LORG:2006-03-09
 	    // Look up the checksum type from owner
-	    Owner->Done(Message,atoi(LookupTag(Message,"Size","0").c_str()),
+	    Owner->Done(Message,Size,
 			LookupTag(Message,Owner->ChecksumType().c_str()),Config);
 	    
 	    ItemDone();
@@ -386,6 +547,7 @@ bool pkgAcquire::Worker::Capabilities(string Message)
    Config->Removable = StringToBool(LookupTag(Message,"Removable"),false);
    // CNC:2004-04-27
    Config->HasPreferredURI = StringToBool(LookupTag(Message,"Has-Preferred-URI"),false);
+   Config->Framed = StringToBool(LookupTag(Message,"Framed"),false);
 
    // Some debug text
    if (Debug == true)
@@ -399,7 +561,8 @@ bool pkgAcquire::Worker::Capabilities(string Message)
 	      " NeedsCleanup: " << Config->NeedsCleanup << 
 	      // CNC:2004-04-27
 	      " Removable: " << Config->Removable <<
-	      " HasPreferredURI: " << Config->HasPreferredURI << endl;
+	      " HasPreferredURI: " << Config->HasPreferredURI <<
+	      " Framed: " << Config->Framed << endl;
    }
    
    return true;
@@ -415,19 +578,13 @@ bool pkgAcquire::Worker::MediaChange(string Message)
    {
       char S[300];
       snprintf(S,sizeof(S),"603 Media Changed\nFailed: true\n\n");
-      if (Debug == true)
-	 clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
-      OutQueue += S;
-      OutReady = true;
+      SendMessage(S);
       return true;
    }
 
    char S[300];
    snprintf(S,sizeof(S),"603 Media Changed\n\n");
-   if (Debug == true)
-      clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
-   OutQueue += S;
-   OutReady = true;
+   SendMessage(S);
    return true;
 }
 									/*}}}*/
@@ -442,20 +599,14 @@ bool pkgAcquire::Worker::Authenticate(string Message)
    {
       char S[300];
       snprintf(S,sizeof(S),"604 Authenticated\nFailed: true\n\n");
-      if (Debug == true)
-	 clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
-      OutQueue += S;
-      OutReady = true;
+      SendMessage(S);
       return true;
    }
 
    char S[300];
    snprintf(S,sizeof(S),"604 Authenticated\nUser: %s\nPassword: %s\n\n",
 	    User.c_str(), Pass.c_str());
-   if (Debug == true)
-      clog << " -> " << Access << ':' << QuoteString(S,"\n") << endl;
-   OutQueue += S;
-   OutReady = true;
+   SendMessage(S);
    return true;
 }
 									/*}}}*/
@@ -464,7 +615,8 @@ bool pkgAcquire::Worker::Authenticate(string Message)
 /* */
 bool pkgAcquire::Worker::SendConfiguration()
 {
-   if (Config->SendConfig == false)
+   // In-process methods already share our configuration
+   if (Config->SendConfig == false || Local != 0)
       return true;
 
    if (OutFd == -1)
@@ -498,10 +650,7 @@ bool pkgAcquire::Worker::SendConfiguration()
    }   
    Message += '\n';
 
-   if (Debug == true)
-      clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
-   OutQueue += Message;
-   OutReady = true; 
+   SendMessage(Message);
    
    return true;
 }
@@ -518,15 +667,29 @@ bool pkgAcquire::Worker::QueueItem(pkgAcquire::Queue::QItem *Item)
    Message.reserve(300);
    Message += "URI: " + Item->URI;
    Message += "\nFilename: " + Item->Owner->DestFile;
+   if (Item->Owner->Checksum().empty() == false)
+      Message += "\nChecksum-Type: " + Item->Owner->ChecksumType();
    Message += Item->Owner->Custom600Headers();
    Message += "\n\n";
    
+   SendMessage(Message);
+   
+   return true;
+}
+									/*}}}*/
+// Worker::SendMessage - Queue a message for the method		/*{{{*/
+// ---------------------------------------------------------------------
+/* Methods that advertised it get length prefixed frames, this saves them
+   from scanning for the end of every message. */
+void pkgAcquire::Worker::SendMessage(const string &Message)
+{
    if (Debug == true)
       clog << " -> " << Access << ':' << QuoteString(Message,"\n") << endl;
-   OutQueue += Message;
+   if (Framed == true)
+      OutQueue += FrameMessage(Message);
+   else
+      OutQueue += Message;
    OutReady = true;
-   
-   return true;
 }
 									/*}}}*/
 // Worker::OutFdRead - Out bound FD is ready				/*{{{*/
@@ -574,7 +737,10 @@ bool pkgAcquire::Worker::MethodFailure()
 {
    _error->Error("Method %s has died unexpectedly!",Access.c_str());
    
-   ExecWait(Process,Access.c_str(),true);
+   if (Local != 0)
+      StopLocal();
+   else
+      ExecWait(Process,Access.c_str(),true);
    Process = -1;
    close(InFd);
    close(OutFd);
@@ -583,7 +749,7 @@ bool pkgAcquire::Worker::MethodFailure()
    OutReady = false;
    InReady = false;
    OutQueue = string();
-   MessageQueue.erase(MessageQueue.begin(),MessageQueue.end());
+   MessageQueue.clear();
    
    return false;
 }
@@ -599,6 +765,8 @@ void pkgAcquire::Worker::Pulse()
    struct stat Buf;
    if (stat(CurrentItem->Owner->DestFile.c_str(),&Buf) != 0)
       return;
+   if ((unsigned long)Buf.st_size != CurrentSize)
+      LastProgress = time(0);
    CurrentSize = Buf.st_size;
    
    // Hmm? Should not happen...
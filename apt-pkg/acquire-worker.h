@@ -14,6 +14,13 @@
 
 #include <apt-pkg/acquire.h>
 
+#include <deque>
+#include <pthread.h>
+
+using std::deque;
+
+class pkgAcqMethod;
+
 // Interfacing to the method process
 class pkgAcquire::Worker
 {
@@ -39,11 +46,27 @@ class pkgAcquire::Worker
    int OutFd;
    bool InReady;
    bool OutReady;
+   bool Framed;
+
+   // Local methods may run on a thread instead of a subprocess
+   pkgAcqMethod *Local;
+   pthread_t Thread;
+   pthread_mutex_t Pause;
+   int LocalFds[2];
+   bool StartLocal(int In,int Out);
+   void StopLocal();
+   bool PauseLocal();
+   void ResumeLocal();
+   static void *RunLocal(void *Me);
    
    // Various internal things
    bool Debug;
-   vector<string> MessageQueue;
+   deque<string> MessageQueue;
    string OutQueue;
+
+   // Transfer timing for the mirror scheduler
+   struct timeval ItemStart;
+   time_t LastProgress;
    
    // Private constructor helper
    void Construct();
@@ -51,6 +74,7 @@ class pkgAcquire::Worker
    // Message handling things
    bool ReadMessages();
    bool RunMessages();
+   void SendMessage(const string &Message);
    bool InFdReady();
    bool OutFdReady();
    
@@ -75,6 +99,7 @@ class pkgAcquire::Worker
    // Load the method and do the startup 
    bool QueueItem(pkgAcquire::Queue::QItem *Item);
    bool Start();
+   bool Restart();
    void Pulse();
    inline const MethodConfig *GetConf() const {return Config;}
    
@@ -19,6 +19,7 @@
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/strutl.h>
+#include <apt-pkg/profile.h>
 
 #include <apti18n.h>
 
@@ -50,6 +51,7 @@ pkgAcquire::pkgAcquire(pkgAcquireStatus *Log) : Log(Log)
       QueueMode = QueueAccess;   
 
    Debug = _config->FindB("Debug::pkgAcquire",false);
+   StallTimeout = _config->FindI("Acquire::Mirror-Stall-Timeout",20);
    
    // This is really a stupid place for this
    struct stat St;
@@ -78,6 +80,34 @@ pkgAcquire::~pkgAcquire()
    }   
 }
 									/*}}}*/
+// Acquire::PauseLocalWorkers - Hold the in-process method threads	/*{{{*/
+// ---------------------------------------------------------------------
+/* A forked child that does not exec must not inherit a thread which may
+   hold a lock. Method threads only run while handling their messages,
+   so once each has been paused between two of them nothing is held.
+   If one is busy right now nothing is paused and false is returned. */
+bool pkgAcquire::PauseLocalWorkers()
+{
+   for (Worker *I = Workers; I != 0; I = I->NextAcquire)
+   {
+      if (I->PauseLocal() == true)
+	 continue;
+      for (Worker *J = Workers; J != I; J = J->NextAcquire)
+	 J->ResumeLocal();
+      return false;
+   }
+   return true;
+}
+									/*}}}*/
+// Acquire::ResumeLocalWorkers - Let the method threads go on		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+void pkgAcquire::ResumeLocalWorkers()
+{
+   for (Worker *I = Workers; I != 0; I = I->NextAcquire)
+      I->ResumeLocal();
+}
+									/*}}}*/
 // Acquire::Shutdown - Clean out the acquire object			/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -182,11 +212,17 @@ void pkgAcquire::Enqueue(ItemDesc &Item)
    // See if this is a local only URI
    if (Config->LocalOnly == true && Item.Owner->Complete == false)
       Item.Owner->Local = true;
-   Item.Owner->Status = Item::StatIdle;
+
+   /* An item offered to several queues (a mirror set) is only counted
+      once, and may already be fetching in one of the other queues */
+   if (Item.Owner->QueueCounter == 0)
+   {
+      Item.Owner->Status = Item::StatIdle;
+      ToFetch++;
+   }
    
    // Queue it into the named queue
    I->Enqueue(Item);
-   ToFetch++;
          
    // Some trace stuff
    if (Debug == true)
@@ -307,6 +343,7 @@ void pkgAcquire::RunFds(fd_set *RSet,fd_set *WSet)
    manage the actual fetch. */
 pkgAcquire::RunResult pkgAcquire::Run()
 {
+   ProfileTimer Timer("pkgAcquire::Run");
    Running = true;
    
    for (Queue *I = Queues; I != 0; I = I->Next)
@@ -353,6 +390,7 @@ pkgAcquire::RunResult pkgAcquire::Run()
 	 tv.tv_usec = 500000;
 	 for (Worker *I = Workers; I != 0; I = I->NextAcquire)
 	    I->Pulse();
+	 CheckStalled();
 	 if (Log != 0 && Log->Pulse(this) == false)
 	 {
 	    WasCancelled = true;
@@ -390,6 +428,34 @@ void pkgAcquire::Bump()
       I->Bump();
 }
 									/*}}}*/
+// Acquire::CheckStalled - Reissue stalled mirrored transfers		/*{{{*/
+// ---------------------------------------------------------------------
+/* A transfer that has not made progress for Acquire::Mirror-Stall-Timeout
+   seconds is taken away from its queue if the item is also queued on
+   another mirror. This can only be done outside of RunFds. */
+void pkgAcquire::CheckStalled()
+{
+   if (StallTimeout <= 0)
+      return;
+   
+   time_t Now = time(0);
+   for (Queue *I = Queues; I != 0; I = I->Next)
+   {
+      for (Worker *W = I->Workers; W != 0; W = W->NextQueue)
+      {
+	 if (W->CurrentItem == 0 ||
+	     W->CurrentItem->Owner->QueueCounter <= 1 ||
+	     Now - W->LastProgress < StallTimeout)
+	    continue;
+	 
+	 if (Debug == true)
+	    clog << "Transfer of " << W->CurrentItem->URI << " stalled" << endl;
+	 I->Reissue(W);
+	 break;
+      }
+   }
+}
+									/*}}}*/
 // Acquire::WorkerStep - Step to the next worker			/*{{{*/
 // ---------------------------------------------------------------------
 /* Not inlined to advoid including acquire-worker.h */
@@ -507,6 +573,7 @@ pkgAcquire::MethodConfig::MethodConfig()
    // CNC:2004-04-27
    HasPreferredURI = false;
    DonePreferredURI = false;
+   Framed = false;
    CheckMethod = "SHA1-Hash";
 }
 									/*}}}*/
@@ -522,6 +589,8 @@ pkgAcquire::Queue::Queue(string Name,pkgAcquire *Owner) : Name(Name),
    Workers = 0;
    MaxPipeDepth = 1;
    PipeDepth = 0;
+   FetchedBytes = 0;
+   FetchTime = 0;
 }
 									/*}}}*/
 // Queue::~Queue - Destructor						/*{{{*/
@@ -551,6 +620,7 @@ void pkgAcquire::Queue::Enqueue(ItemDesc &Item)
    QItem *Itm = new QItem;
    *Itm = Item;
    Itm->Next = 0;
+   Itm->Worker = 0;
    *I = Itm;
    
    Item.Owner->QueueCounter++;   
@@ -690,6 +760,7 @@ bool pkgAcquire::Queue::Cycle()
    bool Preferred = (Workers->Config->HasPreferredURI == true &&
 		     Workers->Config->DonePreferredURI == false &&
 		     Workers->Config->PreferredURI.empty() == false);
+   signed long Depth = MirrorDepth();
    QItem *I = Items;
    while (PipeDepth < (signed)MaxPipeDepth)
    {
@@ -701,8 +772,10 @@ bool pkgAcquire::Queue::Cycle()
 		        Workers->Config->PreferredURI.length()) == 0)
 	       break;
       } else {
+	 // Items of a mirror set are only taken up to our share
 	 for (; I != 0; I = I->Next)
-	    if (I->Owner->Status == pkgAcquire::Item::StatIdle)
+	    if (I->Owner->Status == pkgAcquire::Item::StatIdle &&
+		(I->Owner->QueueCounter <= 1 || PipeDepth < Depth))
 	       break;
       }
       
@@ -736,6 +809,62 @@ void pkgAcquire::Queue::Bump()
    Cycle();
 }
 									/*}}}*/
+// Queue::MirrorDepth - Pipeline depth for items of a mirror set	/*{{{*/
+// ---------------------------------------------------------------------
+/* The fastest queue gets the full pipeline, slower ones a share in
+   proportion to their measured throughput. Queues without measurements
+   yet get a single item so they are measured soon. */
+unsigned long pkgAcquire::Queue::MirrorDepth() const
+{
+   double Best = 0;
+   for (Queue *I = Owner->Queues; I != 0; I = I->Next)
+      if (I->Rate() > Best)
+	 Best = I->Rate();
+   if (Rate() <= 0 || Best <= 0)
+      return 1;
+   
+   unsigned long Depth = (unsigned long)(MaxPipeDepth*Rate()/Best);
+   if (Depth == 0)
+      return 1;
+   return Depth;
+}
+									/*}}}*/
+// Queue::Reissue - Take a stalled transfer away from the worker	/*{{{*/
+// ---------------------------------------------------------------------
+/* The method is restarted, everything that was sent to it goes back to
+   the idle state and the stalled item is removed from this queue so that
+   another mirror picks it up, resuming from the partial file. */
+bool pkgAcquire::Queue::Reissue(pkgAcquire::Worker *Work)
+{
+   pkgAcquire::Item *Stalled = Work->CurrentItem->Owner;
+   
+   // Make sure some other queue is left to fetch it
+   unsigned int Here = 0;
+   for (QItem *I = Items; I != 0; I = I->Next)
+      if (I->Owner == Stalled)
+	 Here++;
+   if (Stalled->QueueCounter <= Here)
+      return true;
+   
+   for (QItem *I = Items; I != 0; I = I->Next)
+   {
+      if (I->Worker != Work ||
+	  I->Owner->Status != pkgAcquire::Item::StatFetching)
+	 continue;
+      I->Owner->Status = pkgAcquire::Item::StatIdle;
+      I->Worker = 0;
+      PipeDepth--;
+   }
+   if (PipeDepth < 0)
+      PipeDepth = 0;
+   
+   Dequeue(Stalled);
+   if (Work->Restart() == false)
+      return false;
+   Owner->Bump();
+   return true;
+}
+									/*}}}*/
 
 // AcquireStatus::pkgAcquireStatus - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
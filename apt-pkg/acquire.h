@@ -22,6 +22,11 @@
    Schedualing of downloads is done on a first ask first get basis. This
    preserves the order of the download as much as possible. And means the
    fastest source will tend to process the largest number of files.
+
+   Items queued into several queues at once (mirror sets) are additionally
+   limited in how deep each queue may pipeline them, in proportion to the
+   throughput measured for that queue, and a transfer that stalls is
+   taken away from its queue so one of the other mirrors can resume it.
    
    Internal methods and queues for performing gzip decompression,
    md5sum hashing and file copying are provided to allow items to apply
@@ -73,6 +78,7 @@ class pkgAcquire
    enum {QueueHost,QueueAccess} QueueMode;
    bool Debug;
    bool Running;
+   long StallTimeout;
    
    void Add(Item *Item);
    void Remove(Item *Item);
@@ -89,6 +95,13 @@ class pkgAcquire
 
    // A queue calls this when it dequeues an item
    void Bump();
+
+   // Hand stalled mirrored transfers over to another queue
+   void CheckStalled();
+
+   // Hold the in-process method threads around a fork
+   bool PauseLocalWorkers();
+   void ResumeLocalWorkers();
    
    public:
 
@@ -167,6 +180,12 @@ class pkgAcquire::Queue
    pkgAcquire *Owner;
    signed long PipeDepth;
    unsigned long MaxPipeDepth;
+
+   // Measured throughput, used to balance mirror sets
+   double FetchedBytes;
+   double FetchTime;
+   inline double Rate() const {return FetchTime > 0 ? FetchedBytes/FetchTime : 0;}
+   unsigned long MirrorDepth() const;
    
    public:
    
@@ -183,6 +202,7 @@ class pkgAcquire::Queue
    bool Shutdown(bool Final);
    bool Cycle();
    void Bump();
+   bool Reissue(pkgAcquire::Worker *Work);
    
    Queue(string Name,pkgAcquire *Owner);
    ~Queue();
@@ -239,6 +259,7 @@ struct pkgAcquire::MethodConfig
    // CNC:2004-04-27
    bool HasPreferredURI;
    bool DonePreferredURI;
+   bool Framed;
    string PreferredURI;
    string CheckMethod;
    
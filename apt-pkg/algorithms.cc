@@ -22,6 +22,7 @@
 // CNC:2002-07-04
 #include <apt-pkg/pkgsystem.h>
 #include <apt-pkg/version.h>
+#include <apt-pkg/profile.h>
     
 #include <apti18n.h>
     
@@ -32,6 +33,11 @@ using namespace std;
 
 pkgProblemResolver *pkgProblemResolver::This = 0;
 
+// Options read for every package or every resolver
+static Configuration::Handle IgnoreHoldOpt("APT::Ignore-Hold");
+static Configuration::Handle RemoveDependsOpt("APT::Remove-Depends");
+static Configuration::Handle DebugResolverOpt("Debug::pkgProblemResolver");
+
 // Simulate::Simulate - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* The legacy translations here of input Pkg iterators is obsolete, 
@@ -317,7 +323,7 @@ bool pkgFixBroken(pkgDepCache &Cache)
    _system->ProcessCache(Cache,Fix);
 
    // CNC:2002-08-08
-   if (_config->FindB("APT::Remove-Depends",false) == true)
+   if (RemoveDependsOpt.FindB(false) == true)
       Fix.RemoveDepends();
    
    return Fix.Resolve(true);
@@ -401,7 +407,7 @@ bool pkgDistUpgrade(pkgDepCache &Cache)
    _system->ProcessCache(Cache,Fix);
 
    // Hold back held packages.
-   if (_config->FindB("APT::Ignore-Hold",false) == false)
+   if (IgnoreHoldOpt.FindB(false) == false)
    {
       for (pkgCache::PkgIterator I = Cache.PkgBegin(); I.end() == false; I++)
       {
@@ -414,7 +420,7 @@ bool pkgDistUpgrade(pkgDepCache &Cache)
    }
 
    // CNC:2002-08-08
-   if (_config->FindB("APT::Remove-Depends",false) == true)
+   if (RemoveDependsOpt.FindB(false) == true)
       Fix.RemoveDepends();
    
    // CNC:2003-03-22
@@ -439,7 +445,7 @@ bool pkgAllUpgrade(pkgDepCache &Cache)
       if (Cache[I].Install() == true)
 	 Fix.Protect(I);
 	  
-      if (_config->FindB("APT::Ignore-Hold",false) == false)
+      if (IgnoreHoldOpt.FindB(false) == false)
 	 if (I->SelectedState == pkgCache::State::Hold)
 	    continue;
       
@@ -509,7 +515,7 @@ pkgProblemResolver::pkgProblemResolver(pkgDepCache *pCache) : Cache(*pCache)
    memset(Flags,0,sizeof(*Flags)*Size);
    
    // Set debug to true to see its decision logic
-   Debug = _config->FindB("Debug::pkgProblemResolver",false);
+   Debug = DebugResolverOpt.FindB(false);
 }
 									/*}}}*/
 // ProblemResolver::~pkgProblemResolver - Destructor			/*{{{*/
@@ -756,6 +762,7 @@ bool pkgProblemResolver::DoUpgrade(pkgCache::PkgIterator Pkg)
    upgrade packages to advoid problems. */
 bool pkgProblemResolver::Resolve(bool BrokenFix)
 {
+   ProfileTimer Timer("pkgProblemResolver::Resolve");
    unsigned long Size = Cache.Head().PackageCount;
 
    // Record which packages are marked for install
@@ -13,22 +13,73 @@
 #include <apt-pkg/error.h>
 #include <apt-pkg/configuration.h>
 
+#include <config.h>
 #include <apti18n.h>    
 
 #include <cstring>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+
+#ifdef HAVE_TR1_UNORDERED_SET
+#include <tr1/unordered_set>
+struct pkgArchiveCleaner::KeepSet : public std::tr1::unordered_set<string> {};
+#else
+#include <set>
+struct pkgArchiveCleaner::KeepSet : public std::set<string> {};
+#endif
 									/*}}}*/
 
+// ArchiveCleaner::~pkgArchiveCleaner - Destructor			/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+pkgArchiveCleaner::~pkgArchiveCleaner()
+{
+   delete Keep;
+}
+									/*}}}*/
+// ArchiveCleaner::BuildKeep - Index the versions worth keeping	/*{{{*/
+// ---------------------------------------------------------------------
+/* Walking the versions of the package named by each file made cleaning
+   large archive directories slow, so every version which can still be
+   fetched is put in a hash set once and files are just looked up. */
+void pkgArchiveCleaner::BuildKeep(pkgCache &Cache,bool CleanInstalled)
+{
+   if (Keep == 0)
+      Keep = new KeepSet;
+   Keep->clear();
+   for (pkgCache::PkgIterator P = Cache.PkgBegin(); P.end() == false; P++)
+   {
+      for (pkgCache::VerIterator V = P.VersionList(); V.end() == false; V++)
+      {
+	 // See if we can fetch this version at all
+	 for (pkgCache::VerFileIterator J = V.FileList(); 
+	      J.end() == false; J++)
+	 {
+	    if (CleanInstalled == true &&
+		(J.File()->Flags & pkgCache::Flag::NotSource) != 0)
+	       continue;
+	    Keep->insert(string(P.Name()) + ' ' + V.VerStr());
+	    break;
+	 }
+      }
+   }
+   KeepHeader = Cache.HeaderP;
+   KeepInstalled = CleanInstalled;
+}
+									/*}}}*/
 // ArchiveCleaner::Go - Perform smart cleanup of the archive		/*{{{*/
 // ---------------------------------------------------------------------
 /* Scan the directory for files to erase, we check the version information
-   against our database to see if it is interesting */
+   against our database to see if it is interesting. Only the files to
+   erase are stat'ed, relative to the open directory. */
 bool pkgArchiveCleaner::Go(string Dir,pkgCache &Cache)
 {
    bool CleanInstalled = _config->FindB("APT::Clean-Installed",true);
    string MyArch = _config->Find("APT::Architecture");
+
+   if (KeepHeader != Cache.HeaderP || KeepInstalled != CleanInstalled)
+      BuildKeep(Cache,CleanInstalled);
       
    DIR *D = opendir(Dir.c_str());
    if (D == 0)
@@ -41,6 +92,7 @@ bool pkgArchiveCleaner::Go(string Dir,pkgCache &Cache)
       return _error->Errno("chdir",_("Unable to change to %s"),Dir.c_str());
    }
    
+   int DirFd = dirfd(D);
    for (struct dirent *Dir = readdir(D); Dir != 0; Dir = readdir(D))
    {
       // Skip some files..
@@ -50,15 +102,6 @@ bool pkgArchiveCleaner::Go(string Dir,pkgCache &Cache)
 	  strcmp(Dir->d_name,"..") == 0)
 	 continue;
 
-      struct stat St;
-      if (stat(Dir->d_name,&St) != 0)
-      {
-	 if(chdir(StartDir.c_str()) != 0)
-	    return _error->Errno("chdir",_("Failed to chdir to %s"),StartDir.c_str());
-	 closedir(D);
-	 return _error->Errno("stat",_("Unable to stat %s."),Dir->d_name);
-      }
-      
       // Grab the package name
       const char *I = Dir->d_name;
       for (; *I != 0 && *I != '_';I++);
@@ -86,33 +129,18 @@ bool pkgArchiveCleaner::Go(string Dir,pkgCache &Cache)
 	 continue;
 #endif
       
-      // Lookup the package
-      pkgCache::PkgIterator P = Cache.FindPkg(Pkg);
-      if (P.end() != true)
+      // We found a match, keep the file
+      if (Keep->find(Pkg + ' ' + Ver) != Keep->end())
+	 continue;
+
+      struct stat St;
+      if (fstatat(DirFd,Dir->d_name,&St,0) != 0)
       {
-	 pkgCache::VerIterator V = P.VersionList();
-	 for (; V.end() == false; V++)
-	 {
-	    // See if we can fetch this version at all
-	    bool IsFetchable = false;
-	    for (pkgCache::VerFileIterator J = V.FileList(); 
-		 J.end() == false; J++)
-	    {
-	       if (CleanInstalled == true &&
-		   (J.File()->Flags & pkgCache::Flag::NotSource) != 0)
-		  continue;
-	       IsFetchable = true;
-	       break;
-	    }
-	    
-	    // See if this verison matches the file
-	    if (IsFetchable == true && Ver == V.VerStr())
-	       break;
-	 }
-	 
-	 // We found a match, keep the file
-	 if (V.end() == false)
-	    continue;
+	 _error->Errno("stat",_("Unable to stat %s."),Dir->d_name);
+	 closedir(D);
+	 if(chdir(StartDir.c_str()) != 0)
+	    return _error->Errno("chdir",_("Failed to chdir to %s"),StartDir.c_str());
+	 return false;
       }
             
       Erase(Dir->d_name,Pkg,Ver,St);
@@ -14,6 +14,14 @@
 
 class pkgArchiveCleaner
 {
+   // "name version" of every version that can still be fetched
+   struct KeepSet;
+   KeepSet *Keep;
+   pkgCache::Header *KeepHeader;
+   bool KeepInstalled;
+
+   void BuildKeep(pkgCache &Cache,bool CleanInstalled);
+
    protected:
    
    virtual void Erase(const char * /*File*/,string /*Pkg*/,string /*Ver*/,struct stat & /*St*/) {}
@@ -21,7 +29,13 @@ class pkgArchiveCleaner
    public:   
    
    bool Go(string Dir,pkgCache &Cache);
-   virtual ~pkgArchiveCleaner() {}
+   pkgArchiveCleaner() : Keep(0), KeepHeader(0), KeepInstalled(false) {}
+   virtual ~pkgArchiveCleaner();
+
+   private:
+
+   pkgArchiveCleaner(const pkgArchiveCleaner &);
+   pkgArchiveCleaner &operator =(const pkgArchiveCleaner &);
 };
 
 #endif
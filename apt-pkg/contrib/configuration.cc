@@ -27,30 +27,175 @@
 #include <iostream>
     
 #include <stdio.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_TR1_UNORDERED_MAP
+#include <tr1/unordered_map>
+#else
+#include <map>
+#endif
+#ifdef HAVE_TR1_UNORDERED_SET
+#include <tr1/unordered_set>
+#else
+#include <set>
+#endif
+
 using namespace std;
 									/*}}}*/
 
 Configuration *_config = new Configuration;
 
+// Bumped whenever items are added to or removed from any tree. A tree
+// made from an item of another one shares its items, so an index built
+// before a change somewhere else can't be trusted anymore.
+static unsigned long TreeGeneration = 0;
+
+// Bumped on any change at all, values included, see Handle
+static unsigned long ConfigGeneration = 1;
+
+// Handles compare the counters without the tree lock
+static inline void Bump(unsigned long &Gen)
+{
+   __sync_fetch_and_add(&Gen,1);
+}
+static inline unsigned long Current(unsigned long &Gen)
+{
+   return __sync_fetch_and_add(&Gen,0);
+}
+
+// TreeGuard - Hold the lock of all configuration trees			/*{{{*/
+// ---------------------------------------------------------------------
+/* Trees made from an item of another one share its items, so a lock per
+   Configuration could not guard them. A single lock covers the items and
+   values of every tree and all the indexes, every method reading or
+   changing them holds it. It is recursive as those methods call each
+   other. fork() takes it first so a child never starts with it held by
+   a thread it did not get. */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t TreeLock;
+static pthread_once_t TreeLockOnce = PTHREAD_ONCE_INIT;
+
+static void TreeLockPrepare()
+{
+   pthread_mutex_lock(&TreeLock);
+}
+static void TreeLockRelease()
+{
+   pthread_mutex_unlock(&TreeLock);
+}
+// The thread of a child has another id than the owner, start afresh
+static void TreeLockReset()
+{
+   pthread_mutexattr_t Attr;
+   pthread_mutexattr_init(&Attr);
+   pthread_mutexattr_settype(&Attr,PTHREAD_MUTEX_RECURSIVE);
+   pthread_mutex_init(&TreeLock,&Attr);
+   pthread_mutexattr_destroy(&Attr);
+}
+static void TreeLockInit()
+{
+   TreeLockReset();
+   pthread_atfork(TreeLockPrepare,TreeLockRelease,TreeLockReset);
+}
+
+class TreeGuard
+{
+   public:
+   TreeGuard()
+   {
+      pthread_once(&TreeLockOnce,TreeLockInit);
+      pthread_mutex_lock(&TreeLock);
+   }
+   ~TreeGuard()
+   {
+      pthread_mutex_unlock(&TreeLock);
+   }
+};
+#else
+class TreeGuard
+{
+   public:
+   TreeGuard() {}
+};
+#endif
+									/*}}}*/
+// Configuration::Index - Faster lookups				/*{{{*/
+// ---------------------------------------------------------------------
+/* Children maps the parent item and lower cased tag to the child, it is
+   filled one parent at a time on the first lookup below it. Names caches
+   the result of fully scoped lookups done by Find() and friends, misses
+   included, and is dropped when items are added. It is only used with
+   the tree lock held. */
+struct Configuration::Index
+{
+#ifdef HAVE_TR1_UNORDERED_MAP
+   typedef tr1::unordered_map<string,Item *> ChildMap;
+   typedef tr1::unordered_map<string,const Item *> NameMap;
+#else
+   typedef map<string,Item *> ChildMap;
+   typedef map<string,const Item *> NameMap;
+#endif
+#ifdef HAVE_TR1_UNORDERED_SET
+   typedef tr1::unordered_set<const Item *> ItemSet;
+#else
+   typedef set<const Item *> ItemSet;
+#endif
+
+   ChildMap Children;
+   ItemSet Indexed;
+   NameMap Names;
+   unsigned long Generation;
+
+   void Flush()
+   {
+      Children.clear();
+      Indexed.clear();
+      Names.clear();
+      Generation = TreeGeneration;
+   }
+
+   Index() : Generation(Current(TreeGeneration)) {}
+};
+
+static string ChildKey(const Configuration::Item *Head,const char *S,
+		       unsigned long Len)
+{
+   string Key((const char *)&Head,sizeof(Head));
+   Key.reserve(sizeof(Head) + Len);
+   for (const char *I = S; I != S + Len; I++)
+      Key += tolower(*I);
+   return Key;
+}
+									/*}}}*/
+
 // Configuration::Configuration - Constructor				/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-Configuration::Configuration() : ToFree(true)
+Configuration::Configuration() : ToFree(true), Idx(new Index)
 {
    Root = new Item;
+   Bump(ConfigGeneration);
 }
-Configuration::Configuration(const Item *Root) : Root((Item *)Root), ToFree(false)
+Configuration::Configuration(const Item *Root) : Root((Item *)Root), ToFree(false),
+   Idx(new Index)
 {
+   Bump(ConfigGeneration);
 }
 
 // CNC:2003-02-23 - Copy constructor.
-Configuration::Configuration(Configuration &Conf) : ToFree(true)
+Configuration::Configuration(Configuration &Conf) : ToFree(true), Idx(new Index)
 {
+   TreeGuard Guard;
    Root = new Item;
+   Bump(ConfigGeneration);
    if (Conf.Root->Child)
       CopyChildren(Conf.Root, Root);
 }
@@ -82,6 +227,9 @@ void Configuration::CopyChildren(Item *From, Item *To)
 /* */
 Configuration::~Configuration()
 {
+   TreeGuard Guard;
+   Bump(ConfigGeneration);
+   delete Idx;
    if (ToFree == false)
       return;
    
@@ -112,37 +260,77 @@ Configuration::~Configuration()
 // Configuration::Lookup - Lookup a single item				/*{{{*/
 // ---------------------------------------------------------------------
 /* This will lookup a single item by name below another item. It is a 
-   helper function for the main lookup function */
+   helper function for the main lookup function, the tree lock is held */
 Configuration::Item *Configuration::Lookup(Item *Head,const char *S,
 					   unsigned long Len,bool Create)
 {
-   int Res = 1;
    Item *I = Head->Child;
    Item **Last = &Head->Child;
    
    // Empty strings match nothing. They are used for lists.
    if (Len != 0)
    {
-      for (; I != 0; Last = &I->Next, I = I->Next)
-	 if ((Res = stringcasecmp(I->Tag,S,S + Len)) == 0)
-	    break;
-   }
-   else
-      for (; I != 0; Last = &I->Next, I = I->Next);
-      
-   if (Res == 0)
+      if (Idx->Generation != TreeGeneration)
+	 Idx->Flush();
+      if (Idx->Indexed.find(Head) == Idx->Indexed.end())
+      {
+	 // The first of equal tags wins, as with a plain walk
+	 for (; I != 0; I = I->Next)
+	    if (I->Tag.empty() == false)
+	       Idx->Children.insert(make_pair(ChildKey(Head,I->Tag.c_str(),
+						       I->Tag.length()),I));
+	 Idx->Indexed.insert(Head);
+      }
+
+      string Key = ChildKey(Head,S,Len);
+      Index::ChildMap::const_iterator C = Idx->Children.find(Key);
+      if (C != Idx->Children.end())
+	 return C->second;
+      if (Create == false)
+	 return 0;
+
+      for (I = Head->Child; I != 0; Last = &I->Next, I = I->Next);
+      I = new Item;
+      I->Tag = string(S,Len);
+      I->Next = *Last;
+      I->Parent = Head;
+      *Last = I;
+      Idx->Children[Key] = I;
+      Changed(false);
       return I;
+   }
+
    if (Create == false)
       return 0;
+   for (; I != 0; Last = &I->Next, I = I->Next);
    
    I = new Item;
    I->Tag = string(S,Len);
    I->Next = *Last;
    I->Parent = Head;
    *Last = I;
+   Changed(false);
    return I;
 }
 									/*}}}*/
+// Configuration::Changed - Note added or removed items			/*{{{*/
+// ---------------------------------------------------------------------
+/* Added items are already in the index of children, only cached misses
+   turn wrong. Removed ones may be anywhere in the index. */
+void Configuration::Changed(bool Removed)
+{
+   TreeGuard Guard;
+   Bump(TreeGeneration);
+   Bump(ConfigGeneration);
+   if (Removed == true)
+   {
+      Idx->Flush();
+      return;
+   }
+   Idx->Names.clear();
+   Idx->Generation = TreeGeneration;
+}
+									/*}}}*/
 // Configuration::Lookup - Lookup a fully scoped item			/*{{{*/
 // ---------------------------------------------------------------------
 /* This performs a fully scoped lookup of a given name, possibly creating
@@ -151,7 +339,8 @@ Configuration::Item *Configuration::Lookup(const char *Name,bool Create)
 {
    if (Name == 0)
       return Root->Child;
-   
+
+   TreeGuard Guard;
    const char *Start = Name;
    const char *End = Start + strlen(Name);
    const char *TagEnd = Name;
@@ -178,11 +367,44 @@ Configuration::Item *Configuration::Lookup(const char *Name,bool Create)
    return Itm;
 }
 									/*}}}*/
+// Configuration::Lookup - Lookup a fully scoped item for reading	/*{{{*/
+// ---------------------------------------------------------------------
+/* The result is remembered by the lower cased name, so the same option
+   read over and over again costs a single hash lookup. */
+const Configuration::Item *Configuration::Lookup(const char *Name) const
+{
+   if (Name == 0)
+      return Root->Child;
+
+   string Key = Name;
+   for (string::iterator I = Key.begin(); I != Key.end(); I++)
+      *I = tolower(*I);
+
+   TreeGuard Guard;
+   if (Idx->Generation != TreeGeneration)
+      Idx->Flush();
+
+   const Item *Itm;
+   Index::NameMap::const_iterator N = Idx->Names.find(Key);
+   if (N != Idx->Names.end())
+      Itm = N->second;
+   else
+   {
+      Itm = ((Configuration *)this)->Lookup(Name,false);
+      // Keep it small, programs looking up endless names exist
+      if (Idx->Names.size() >= 4096)
+	 Idx->Names.clear();
+      Idx->Names[Key] = Itm;
+   }
+   return Itm;
+}
+									/*}}}*/
 // Configuration::Find - Find a value					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
 string Configuration::Find(const char *Name,const char *Default) const
 {
+   TreeGuard Guard;
    const Item *Itm = Lookup(Name);
    if (Itm == 0 || Itm->Value.empty() == true)
    {
@@ -202,6 +424,7 @@ string Configuration::Find(const char *Name,const char *Default) const
  */
 string Configuration::FindFile(const char *Name,const char *Default) const
 {
+   TreeGuard Guard;
    const Item *Itm = Lookup(Name);
    if (Itm == 0 || Itm->Value.empty() == true)
    {
@@ -252,6 +475,7 @@ string Configuration::FindDir(const char *Name,const char *Default) const
 /* */
 int Configuration::FindI(const char *Name,int Default) const
 {
+   TreeGuard Guard;
    const Item *Itm = Lookup(Name);
    if (Itm == 0 || Itm->Value.empty() == true)
       return Default;
@@ -269,6 +493,7 @@ int Configuration::FindI(const char *Name,int Default) const
 /* */
 bool Configuration::FindB(const char *Name,bool Default) const
 {
+   TreeGuard Guard;
    const Item *Itm = Lookup(Name);
    if (Itm == 0 || Itm->Value.empty() == true)
       return Default;
@@ -323,11 +548,15 @@ string Configuration::FindAny(const char *Name,const char *Default) const
 /* This will not overwrite */
 void Configuration::CndSet(const char *Name,string Value)
 {
+   TreeGuard Guard;
    Item *Itm = Lookup(Name,true);
    if (Itm == 0)
       return;
    if (Itm->Value.empty() == true)
+   {
       Itm->Value = Value;
+      Bump(ConfigGeneration);
+   }
 }
 									/*}}}*/
 // Configuration::Set - Set a value					/*{{{*/
@@ -335,10 +564,12 @@ void Configuration::CndSet(const char *Name,string Value)
 /* */
 void Configuration::Set(const char *Name,string Value)
 {
+   TreeGuard Guard;
    Item *Itm = Lookup(Name,true);
    if (Itm == 0)
       return;
    Itm->Value = Value;
+   Bump(ConfigGeneration);
 }
 									/*}}}*/
 // Configuration::Set - Set an integer value				/*{{{*/
@@ -346,12 +577,14 @@ void Configuration::Set(const char *Name,string Value)
 /* */
 void Configuration::Set(const char *Name,int Value)
 {
+   TreeGuard Guard;
    Item *Itm = Lookup(Name,true);
    if (Itm == 0)
       return;
    char S[300];
    snprintf(S,sizeof(S),"%i",Value);
    Itm->Value = S;
+   Bump(ConfigGeneration);
 }
 									/*}}}*/
 // Configuration::Clear - Clear an entire tree				/*{{{*/
@@ -359,14 +592,18 @@ void Configuration::Set(const char *Name,int Value)
 /* */
 void Configuration::Clear(string Name)
 {
+   TreeGuard Guard;
    Item *Top = Lookup(Name.c_str(),false);
    if (Top == 0)
       return;
    
    Top->Value = string();
+   Bump(ConfigGeneration);
    Item *Stop = Top;
    Top = Top->Child;
    Stop->Child = 0;
+   if (Top != 0)
+      Changed(true);
    for (; Top != 0;)
    {
       if (Top->Child != 0)
@@ -397,6 +634,7 @@ void Configuration::Clear(string Name)
 /* */
 bool Configuration::Exists(const char *Name) const
 {
+   TreeGuard Guard;
    const Item *Itm = Lookup(Name);
    if (Itm == 0)
       return false;
@@ -434,6 +672,7 @@ void Configuration::Dump(ostream& str)
 {
    /* Write out all of the configuration directives by walking the 
       configuration tree */
+   TreeGuard Guard;
    const Configuration::Item *Top = Tree(0);
    for (; Top != 0;)
    {
@@ -453,6 +692,73 @@ void Configuration::Dump(ostream& str)
 }
 									/*}}}*/
 
+// Configuration::Generation - Count of changes to configurations	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+unsigned long Configuration::Generation()
+{
+   return Current(ConfigGeneration);
+}
+									/*}}}*/
+// Configuration::Handle::Resolve - Look the option up again		/*{{{*/
+// ---------------------------------------------------------------------
+/* All the conversions are done here once, so reading the handle is
+   just a comparison of the generation. */
+void Configuration::Handle::Resolve(const Configuration &Cnf)
+{
+   TreeGuard Guard;
+   Conf = &Cnf;
+   Gen = Current(ConfigGeneration);
+
+   Value = Cnf.Find(Name);
+   File = Cnf.FindFile(Name);
+
+   char *End;
+   IValue = strtol(Value.c_str(),&End,0);
+   IValid = (Value.empty() == false && End != Value.c_str());
+   BValue = Value.empty() == true ? -1 : StringToBool(Value,-1);
+}
+									/*}}}*/
+// Configuration::Handle::Find* - Read the option			/*{{{*/
+// ---------------------------------------------------------------------
+/* These behave just like the Configuration methods of the same name. */
+string Configuration::Handle::Find(const char *Default,const Configuration &Cnf)
+{
+   if (Conf != &Cnf || Gen != Current(ConfigGeneration))
+      Resolve(Cnf);
+   if (Value.empty() == true)
+      return Default == 0 ? string() : string(Default);
+   return Value;
+}
+string Configuration::Handle::FindFile(const char *Default,const Configuration &Cnf)
+{
+   if (Conf != &Cnf || Gen != Current(ConfigGeneration))
+      Resolve(Cnf);
+   if (File.empty() == true)
+      return Default == 0 ? string() : string(Default);
+   return File;
+}
+string Configuration::Handle::FindDir(const char *Default,const Configuration &Cnf)
+{
+   string Res = FindFile(Default,Cnf);
+   if (Res.empty() == true || Res.end()[-1] != '/')
+      return Res + '/';
+   return Res;
+}
+int Configuration::Handle::FindI(int Default,const Configuration &Cnf)
+{
+   if (Conf != &Cnf || Gen != Current(ConfigGeneration))
+      Resolve(Cnf);
+   return IValid == true ? IValue : Default;
+}
+bool Configuration::Handle::FindB(bool Default,const Configuration &Cnf)
+{
+   if (Conf != &Cnf || Gen != Current(ConfigGeneration))
+      Resolve(Cnf);
+   return BValue == -1 ? Default : BValue;
+}
+									/*}}}*/
+
 // Configuration::Item::FullTag - Return the fully scoped tag		/*{{{*/
 // ---------------------------------------------------------------------
 /* Stop sets an optional max recursion depth if this item is being viewed as
@@ -54,19 +54,27 @@ class Configuration
    
    Item *Root;
    bool ToFree;
+
+   // Hash of the children of the items and cache of the fully scoped
+   // lookups, both private to configuration.cc
+   struct Index;
+   Index *Idx;
    
    Item *Lookup(Item *Head,const char *S,unsigned long Len,bool Create);
    Item *Lookup(const char *Name,bool Create);   
-   inline const Item *Lookup(const char *Name) const
-   {
-      return ((Configuration *)this)->Lookup(Name,false);
-   }  
+   const Item *Lookup(const char *Name) const;
+   void Changed(bool Removed);
 
    // CNC:2003-02-23 - Helper for copy constructor.
    void CopyChildren(Item *From, Item *To);
+
+   // The index can't be shared, copy through the copy constructor
+   Configuration &operator =(const Configuration &);
    
    public:
 
+   class Handle;
+
    string Find(const char *Name,const char *Default = 0) const;
    string Find(string Name,const char *Default = 0) const {return Find(Name.c_str(),Default);}
    string FindFile(const char *Name,const char *Default = 0) const;
@@ -88,11 +96,15 @@ class Configuration
 
    void Clear(string Name);
    
+   // Walking the items below is not locked, don't change the tree meanwhile
    inline const Item *Tree(const char *Name) const {return Lookup(Name);}
 
    inline void Dump() { Dump(std::clog); }
    void Dump(std::ostream& str);
 
+   // Bumped on every change to any configuration, see Handle
+   static unsigned long Generation();
+
    // CNC:2003-02-23 - Copy constructor.
    Configuration(Configuration &Conf);
 
@@ -103,6 +115,37 @@ class Configuration
 
 extern Configuration *_config;
 
+// Configuration::Handle - A single option resolved once
+// Loops reading the same option over and over can keep one of these,
+// usually static, instead of looking the option up by name each time.
+// It is resolved again only when some configuration changed, or when
+// it is read from another one than before (_config may be replaced).
+// A handle must not be used from several threads at once.
+class Configuration::Handle
+{
+   const char *Name;
+   const Configuration *Conf;
+   unsigned long Gen;
+
+   string Value;
+   string File;
+   int IValue;
+   bool IValid;
+   int BValue;
+
+   void Resolve(const Configuration &Cnf);
+
+   public:
+
+   string Find(const char *Default = 0,const Configuration &Cnf = *_config);
+   string FindFile(const char *Default = 0,const Configuration &Cnf = *_config);
+   string FindDir(const char *Default = 0,const Configuration &Cnf = *_config);
+   int FindI(int Default = 0,const Configuration &Cnf = *_config);
+   bool FindB(bool Default = false,const Configuration &Cnf = *_config);
+
+   Handle(const char *Name) : Name(Name), Conf(0), Gen(0) {}
+};
+
 bool ReadConfigFile(Configuration &Conf,string FName,bool AsSectional = false,
 		    unsigned Depth = 0);
 
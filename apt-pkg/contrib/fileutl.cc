@@ -5,7 +5,7 @@
    
    File Utilities
    
-   CopyFile - Buffered copy of a single file
+   CopyFile - Copy of a single file, in the kernel where possible
    GetLock - dpkg compatible lock file manipulation (fcntl)
    
    This source is placed in the Public Domain, do with it what you will
@@ -30,6 +30,16 @@
 #include <signal.h>
 #include <errno.h>
 
+#include "config.h"
+
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 // CNC:2003-02-14 - Ralf Corsepius told RH8 with GCC 3.2.1 fails
 //                  compiling without moving this header to here.
 #include <apti18n.h>
@@ -38,17 +48,57 @@
 
 using namespace std;
 
-// CopyFile - Buffered copy of a file					/*{{{*/
+// CopyFile - Copy a file						/*{{{*/
 // ---------------------------------------------------------------------
-/* The caller is expected to set things so that failure causes erasure */
+/* The caller is expected to set things so that failure causes erasure.
+   A whole file copy shares the blocks of the source on filesystems that
+   support it, otherwise the kernel is asked to move the data and only
+   when that is not possible a userspace buffer is used. */
 bool CopyFile(FileFd &From,FileFd &To)
 {
    if (From.IsOpen() == false || To.IsOpen() == false)
       return false;
    
+   unsigned long Size = From.Size();
+
+#ifdef FICLONE
+   if (Size != 0 && lseek(From.Fd(),0,SEEK_CUR) == 0 &&
+       lseek(To.Fd(),0,SEEK_CUR) == 0 &&
+       ioctl(To.Fd(),FICLONE,From.Fd()) == 0)
+   {
+      lseek(From.Fd(),Size,SEEK_SET);
+      lseek(To.Fd(),Size,SEEK_SET);
+      return true;
+   }
+#endif
+
+   /* These move the file offsets along, so whatever they could not do
+      is left to the next one */
+#ifdef HAVE_COPY_FILE_RANGE
+   while (Size != 0)
+   {
+      ssize_t Res = copy_file_range(From.Fd(),0,To.Fd(),0,Size,0);
+      if (Res < 0 && errno == EINTR)
+	 continue;
+      if (Res <= 0)
+	 break;
+      Size -= Res;
+   }
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+   while (Size != 0)
+   {
+      ssize_t Res = sendfile(To.Fd(),From.Fd(),0,Size);
+      if (Res < 0 && errno == EINTR)
+	 continue;
+      if (Res <= 0)
+	 break;
+      Size -= Res;
+   }
+#endif
+   
    // Buffered copy between fds
    SPtrArray<unsigned char> Buf = new unsigned char[64000];
-   unsigned long Size = From.Size();
    while (Size != 0)
    {
       unsigned long ToRead = Size;
@@ -80,7 +80,10 @@ bool MMap::Map(FileFd &Fd)
    // Map it.
    Base = mmap(0,iSize,Prot,Map,Fd.Fd(),0);
    if (Base == (void *)-1)
+   {
+      Base = 0;
       return _error->Errno("mmap",_("Couldn't make mmap of %lu bytes"),(unsigned long) iSize);
+   }
 
    return true;
 }
@@ -0,0 +1,179 @@
+// -*- mode: c++; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Profile - Stage timers and counters for production runs
+
+   ##################################################################### */
+									/*}}}*/
+// Include Files							/*{{{*/
+#include <apt-pkg/profile.h>
+#include <apt-pkg/configuration.h>
+#include <apt-pkg/error.h>
+
+#include <config.h>
+
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <apti18n.h>
+									/*}}}*/
+
+using std::map;
+using std::string;
+
+bool Profile::Enabled = false;
+unsigned long long Profile::Counters[Profile::CounterCount];
+
+// Names of the counters in the report, in CounterId order
+static const char *CounterNames[Profile::CounterCount] =
+   {"headers-parsed", "versions-compared", "strings-interned",
+    "bytes-fetched"};
+
+static struct ProfileState
+{
+   struct Stage
+   {
+      unsigned long Calls;
+      double Seconds;
+      Stage() : Calls(0), Seconds(0) {}
+   };
+
+   map<string,Stage> Stages;
+   string File;
+   double Start;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t Lock;
+
+   // Held across fork() so no child starts with it taken
+   static void Prepare();
+   static void Release();
+#endif
+
+   ProfileState() : Start(0)
+   {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_init(&Lock, NULL);
+      pthread_atfork(Prepare, Release, Release);
+#endif
+   }
+} State;
+
+#ifdef HAVE_PTHREAD
+void ProfileState::Prepare()
+{
+   pthread_mutex_lock(&State.Lock);
+}
+
+void ProfileState::Release()
+{
+   pthread_mutex_unlock(&State.Lock);
+}
+#endif
+
+static void WriteReport()
+{
+   Profile::Report();
+}
+
+// Profile::Now - Seconds on the monotonic clock			/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+double Profile::Now()
+{
+   struct timespec TS;
+   clock_gettime(CLOCK_MONOTONIC,&TS);
+   return TS.tv_sec + TS.tv_nsec/1000000000.0;
+}
+									/*}}}*/
+// Profile::AddTime - Account a run of a stage				/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+void Profile::AddTime(const char *Stage,double Seconds)
+{
+#ifdef HAVE_PTHREAD
+   pthread_mutex_lock(&State.Lock);
+#endif
+   ProfileState::Stage &S = State.Stages[Stage];
+   S.Calls++;
+   S.Seconds += Seconds;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_unlock(&State.Lock);
+#endif
+}
+									/*}}}*/
+// Profile::Init - Turn the profile on if it was asked for		/*{{{*/
+// ---------------------------------------------------------------------
+/* Only the first call counts, the report covers the whole process. */
+bool Profile::Init(Configuration &Cnf)
+{
+   if (Enabled == true)
+      return true;
+
+   State.File = Cnf.Find("APT::Profile");
+   if (State.File.empty() == true)
+      return true;
+   if (State.File != "-")
+      State.File = Cnf.FindFile("APT::Profile");
+
+   State.Start = Now();
+   Enabled = true;
+   if (atexit(WriteReport) != 0)
+      return _error->Error(_("Unable to register the profile report"));
+   return true;
+}
+									/*}}}*/
+// Profile::Report - Write the JSON report				/*{{{*/
+// ---------------------------------------------------------------------
+/* Stage names are C identifiers and scopes, so they need no escaping. */
+bool Profile::Report()
+{
+   if (Enabled == false)
+      return true;
+
+   FILE *F = stderr;
+   if (State.File != "-")
+   {
+      F = fopen(State.File.c_str(),"w");
+      if (F == NULL)
+	 return _error->Errno("fopen",_("Unable to write the profile report %s"),
+			      State.File.c_str());
+   }
+
+#ifdef HAVE_PTHREAD
+   pthread_mutex_lock(&State.Lock);
+#endif
+   fprintf(F,"{\n  \"pid\": %lu,\n  \"seconds\": %.6f,\n  \"timers\": {",
+	   (unsigned long)getpid(),Now() - State.Start);
+   const char *Sep = "\n";
+   for (map<string,ProfileState::Stage>::const_iterator I = State.Stages.begin();
+	I != State.Stages.end(); I++)
+   {
+      fprintf(F,"%s    \"%s\": {\"calls\": %lu, \"seconds\": %.6f}",Sep,
+	      I->first.c_str(),I->second.Calls,I->second.Seconds);
+      Sep = ",\n";
+   }
+   fprintf(F,"\n  },\n  \"counters\": {");
+   Sep = "\n";
+   for (unsigned int I = 0; I != CounterCount; I++)
+   {
+      fprintf(F,"%s    \"%s\": %llu",Sep,CounterNames[I],Counters[I]);
+      Sep = ",\n";
+   }
+   fprintf(F,"\n  }\n}\n");
+#ifdef HAVE_PTHREAD
+   pthread_mutex_unlock(&State.Lock);
+#endif
+
+   if (F != stderr)
+      fclose(F);
+   return true;
+}
+									/*}}}*/
@@ -0,0 +1,67 @@
+// -*- mode: c++; mode: fold -*-
+// Description								/*{{{*/
+/* ######################################################################
+
+   Profile - Stage timers and counters for production runs
+
+   The big stages of the library (building the cache, the dependency
+   cache, resolving, ordering, acquiring, installing) time themselves
+   with a ProfileTimer and a few hot spots bump counters. Nothing is
+   recorded unless APT::Profile names a file, at exit a JSON report of
+   the totals is written there ("-" is standard error).
+
+   Timers with the same name add up, so a stage that runs several
+   times reports its number of calls and the time of all of them.
+
+   ##################################################################### */
+									/*}}}*/
+#ifndef PKGLIB_PROFILE_H
+#define PKGLIB_PROFILE_H
+
+#include <time.h>
+
+class Configuration;
+class Profile
+{
+   public:
+
+   enum CounterId {HeadersParsed, VersionsCompared, StringsInterned,
+                   BytesFetched, CounterCount};
+
+   static bool Enabled;
+   static unsigned long long Counters[CounterCount];
+
+   static inline void Count(CounterId Id,unsigned long long N = 1)
+   {
+      if (Enabled == true)
+	 __sync_fetch_and_add(&Counters[Id],N);
+   }
+   static void AddTime(const char *Stage,double Seconds);
+   static double Now();
+
+   // Reads APT::Profile and arranges for the report to be written
+   static bool Init(Configuration &Cnf);
+   static bool Report();
+};
+
+// Adds the time until it goes out of scope to the named stage
+class ProfileTimer
+{
+   const char *Stage;
+   double Start;
+
+   public:
+
+   ProfileTimer(const char *Stage) : Stage(Stage), Start(0)
+   {
+      if (Profile::Enabled == true)
+	 Start = Profile::Now();
+   }
+   ~ProfileTimer()
+   {
+      if (Profile::Enabled == true && Start != 0)
+	 Profile::AddTime(Stage,Profile::Now() - Start);
+   }
+};
+
+#endif
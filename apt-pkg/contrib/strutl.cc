@@ -536,17 +536,17 @@ int stringcasecmp(string::const_iterator A,string::const_iterator AEnd,
 // ---------------------------------------------------------------------
 /* The format is like those used in package files and the method 
    communication system */
-string LookupTag(string Message,const char *Tag,const char *Default)
+string LookupTag(const string &Message,const char *Tag,const char *Default)
 {
    // Look for a matching tag.
    size_t Length = strlen(Tag);
-   for (string::iterator I = Message.begin(); I + Length < Message.end(); I++)
+   for (string::const_iterator I = Message.begin(); I + Length < Message.end(); I++)
    {
       // Found the tag
       if (I[Length] == ':' && stringcasecmp(I,I+Length,Tag) == 0)
       {
 	 // Find the end of line and strip the leading/trailing spaces
-	 string::iterator J;
+	 string::const_iterator J;
 	 I += Length + 1;
 	 for (; isspace(*I) != 0 && I < Message.end(); I++);
 	 for (J = I; *J != '\n' && J < Message.end(); J++);
@@ -617,8 +617,13 @@ string TimeRFC1123(time_t Date)
 // ---------------------------------------------------------------------
 /* This pulls full messages from the input FD into the message buffer. 
    It assumes that messages will not pause during transit so no
-   fancy buffering is used. */
-bool ReadMessages(int Fd, vector<string> &List)
+   fancy buffering is used.
+
+   Text messages are ended by a blank line. A framed message starts with
+   a 0 byte and its length as 4 bytes in network order, so it is taken
+   out without scanning it. Both can follow each other on the same FD,
+   Framed is set if any framed message was read. */
+bool ReadMessages(int Fd, deque<string> &List, bool *Framed)
 {
    char Buffer[64000];
    char *End = Buffer;
@@ -641,23 +646,69 @@ bool ReadMessages(int Fd, vector<string> &List)
 			      
       End += Res;
       
-      // Look for the end of the message
-      for (char *I = Buffer; I + 1 < End; I++)
+      // Pull out all the complete messages
+      char *Start = Buffer;
+      while (Start < End)
       {
-	 if (I[0] != '\n' || I[1] != '\n')
-	    continue;
+	 if (*Start == 0)
+	 {
+	    if (End - Start < 5)
+	       break;
+	    
+	    unsigned char *Head = (unsigned char *)Start + 1;
+	    unsigned long Len = ((unsigned long)Head[0] << 24) | 
+	                        (Head[1] << 16) | (Head[2] << 8) | Head[3];
+	    if ((unsigned long)(End - Start - 5) >= Len)
+	    {
+	       List.push_back(string(Start + 5,Len));
+	       Start += 5 + Len;
+	       if (Framed != 0)
+		  *Framed = true;
+	       continue;
+	    }
+	    
+	    // Messages that do not fit the buffer are read in directly
+	    if (Len <= sizeof(Buffer) - 5)
+	       break;
+	    string Message(Start + 5,End - Start - 5);
+	    Message.resize(Len);
+	    for (unsigned long Got = End - Start - 5; Got < Len;)
+	    {
+	       Res = read(Fd,&Message[Got],Len - Got);
+	       if (Res < 0 && errno == EINTR)
+		  continue;
+	       if (Res < 0 && errno == EAGAIN)
+	       {
+		  if (WaitFd(Fd) == false)
+		     return false;
+		  continue;
+	       }
+	       if (Res <= 0)
+		  return false;
+	       Got += Res;
+	    }
+	    List.push_back(Message);
+	    if (Framed != 0)
+	       *Framed = true;
+	    Start = End;
+	    break;
+	 }
+	 
+	 // Look for the end of the message
+	 char *I = Start;
+	 for (; I + 1 < End && (I[0] != '\n' || I[1] != '\n'); I++);
+	 if (I + 1 >= End)
+	    break;
 	 
 	 // Pull the message out
-	 string Message(Buffer,I-Buffer);
-
-	 // Fix up the buffer
+	 List.push_back(string(Start,I-Start));
 	 for (; I < End && *I == '\n'; I++);
-	 End -= I-Buffer;	 
-	 memmove(Buffer,I,End-Buffer);
-	 I = Buffer;
-	 
-	 List.push_back(Message);
+	 Start = I;
       }
+
+      // Fix up the buffer
+      End -= Start - Buffer;
+      memmove(Buffer,Start,End - Buffer);
       if (End == Buffer)
 	 return true;
 
@@ -666,6 +717,24 @@ bool ReadMessages(int Fd, vector<string> &List)
    }   
 }
 									/*}}}*/
+// FrameMessage - Build the framed form of a message			/*{{{*/
+// ---------------------------------------------------------------------
+/* The trailing blank line of the text form is not needed in a frame */
+string FrameMessage(const string &Message)
+{
+   string::size_type Len = Message.length();
+   while (Len > 0 && Message[Len - 1] == '\n')
+      Len--;
+   
+   string Frame(5,'\0');
+   Frame[1] = (Len >> 24) & 0xff;
+   Frame[2] = (Len >> 16) & 0xff;
+   Frame[3] = (Len >> 8) & 0xff;
+   Frame[4] = Len & 0xff;
+   Frame.append(Message,0,Len);
+   return Frame;
+}
+									/*}}}*/
 // MonthConv - Converts a month string into a number			/*{{{*/
 // ---------------------------------------------------------------------
 /* This was lifted from the boa webserver which lifted it from 'wn-v1.07'
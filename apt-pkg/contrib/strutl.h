@@ -20,11 +20,13 @@
 #include <cstring>
 #include <string>
 #include <vector>
+#include <deque>
 #include <iostream>
 #include <time.h>
 
 using std::string;
 using std::vector;
+using std::deque;
 using std::ostream;
 
 #ifdef __GNUG__
@@ -48,9 +50,10 @@ string Base64Encode(string Str);
 string URItoFileName(string URI);
 string TimeRFC1123(time_t Date);
 bool StrToTime(string Val,time_t &Result);
-string LookupTag(string Message,const char *Tag,const char *Default = 0);
+string LookupTag(const string &Message,const char *Tag,const char *Default = 0);
 int StringToBool(string Text,int Default = -1);
-bool ReadMessages(int Fd, vector<string> &List);
+bool ReadMessages(int Fd, deque<string> &List, bool *Framed = 0);
+string FrameMessage(const string &Message);
 bool StrToNum(const char *Str,unsigned long &Res,unsigned Len,unsigned Base = 0);
 bool Hex2Num(string Str,unsigned char *Num,unsigned int Length);
 bool TokSplitString(char Tok,char *Input,char **List,
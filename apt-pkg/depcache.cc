@@ -16,6 +16,7 @@
 
 // CNC:2002-07-05
 #include <apt-pkg/pkgsystem.h>
+#include <apt-pkg/profile.h>
 
 // CNC:2003-03-17
 #include <config.h>
@@ -51,6 +52,7 @@ pkgDepCache::~pkgDepCache()
 /* This allocats the extension buffers and initializes them. */
 bool pkgDepCache::Init(OpProgress *Prog)
 {
+   ProfileTimer Timer("pkgDepCache::Init");
    delete [] PkgState;
    delete [] DepState;
    PkgState = new StateCache[Head().PackageCount];
@@ -547,6 +549,7 @@ void pkgDepCache::UpdateVerState(PkgIterator Pkg)
    dependencies based on the current policy. */
 void pkgDepCache::Update(OpProgress *Prog)
 {   
+   ProfileTimer Timer("pkgDepCache::Update");
    iUsrSize = 0;
    iDownloadSize = 0;
    iDelCount = 0;
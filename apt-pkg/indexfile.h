@@ -78,6 +78,10 @@ class pkgIndexFile
    virtual bool Merge(pkgCacheGenerator &/*Gen*/,OpProgress &/*Prog*/) const {return false;}
    virtual bool MergeFileProvides(pkgCacheGenerator &/*Gen*/,OpProgress &/*Prog*/) const {return true;}
    virtual pkgCache::PkgFileIterator FindInCache(pkgCache &Cache) const;
+
+   // Update the stale entry of an earlier cache with what changed since
+   virtual bool CanMergeDelta(pkgCache &/*Cache*/) const {return false;}
+   virtual bool MergeDelta(pkgCacheGenerator &/*Gen*/,OpProgress &/*Prog*/) const {return false;}
    
    virtual ~pkgIndexFile() {}
 };
@@ -11,6 +11,7 @@
 #include <apt-pkg/init.h>
 #include <apt-pkg/fileutl.h>
 #include <apt-pkg/error.h>
+#include <apt-pkg/profile.h>
 
 #include <cstdlib>
 #include <cstring>
@@ -65,6 +66,8 @@ bool pkgInitConfig(Configuration &Cnf)
    Cnf.Set("Dir::Cache::archives","archives/");
    Cnf.Set("Dir::Cache::srcpkgcache","srcpkgcache.bin");
    Cnf.Set("Dir::Cache::pkgcache","pkgcache.bin");
+   Cnf.Set("Dir::Cache::lua","lua/");
+   Cnf.Set("Dir::Cache::rpmdbmap","rpmdbmap");
    
    // Configuration
    Cnf.Set("Dir::Etc","etc/apt/");
@@ -126,6 +129,9 @@ bool pkgInitSystem(Configuration &Cnf,pkgSystem *&Sys)
 {
    ForceLinkage(); // CNC:2003-02-16 - See above.
 
+   if (Profile::Init(Cnf) == false)
+      return false;
+
    Sys = 0;
    string Label = Cnf.Find("Apt::System","");
    if (Label.empty() == false)
@@ -29,14 +29,21 @@ extern "C" {
 #include <apt-pkg/sptr.h>
 #include <apt-pkg/version.h>
 #include <apt-pkg/pkgsystem.h>
+#include <apt-pkg/fileutl.h>
+#include <apt-pkg/md5.h>
 
 #include <apt-pkg/luaiface.h>
 
 #include <apti18n.h>
 
+#include <new>
 #include <limits.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <assert.h>
 
 using namespace std;
@@ -81,7 +88,9 @@ static int AptLua_pkgcomp(lua_State *L);
 #define CACHE_KEY "ChunkCache"
 
 Lua::Lua()
-      : DepCache(0), Cache(0), CacheControl(0), Fix(0), DontFix(0)
+      : DepCache(0), Cache(0), CacheGeneration(0), Records(0),
+	RecordsCache(0),
+	CacheControl(0), Fix(0), DontFix(0)
 {
    _config->CndSet("Dir::Bin::scripts", PKGDATADIR "/scripts");
 
@@ -138,6 +147,7 @@ Lua::Lua()
 
 Lua::~Lua()
 {
+   delete Records;
    if (CacheControl)
       CacheControl->Close();
    lua_close(L);
@@ -151,6 +161,94 @@ bool Lua::HasScripts(const char *ConfListKey)
    return false;
 }
 
+static int AptAux_ChunkWriter(lua_State *L, const void *Data, size_t Size,
+			      void *Chunk)
+{
+   ((string *)Chunk)->append((const char *)Data, Size);
+   return 0;
+}
+
+// Read a whole bytecode cache file, provided it is ours and was written
+// for the same script contents and Lua version as described by Key
+static bool AptAux_ReadChunk(const string &CacheFile, const string &Key,
+			     string &Chunk)
+{
+   int Fd = open(CacheFile.c_str(), O_RDONLY);
+   if (Fd < 0)
+      return false;
+   struct stat St;
+   if (fstat(Fd, &St) != 0 || St.st_uid != geteuid() ||
+       (St.st_mode & (S_IWGRP|S_IWOTH)) != 0 ||
+       (size_t)St.st_size <= Key.length()) {
+      close(Fd);
+      return false;
+   }
+   Chunk.resize(St.st_size);
+   size_t Done = 0;
+   while (Done < Chunk.length()) {
+      ssize_t Res = read(Fd, &Chunk[Done], Chunk.length() - Done);
+      if (Res <= 0)
+	 break;
+      Done += Res;
+   }
+   close(Fd);
+   return Done == Chunk.length() && Chunk.compare(0, Key.length(), Key) == 0;
+}
+
+// Load a script, going through the bytecode cache in Dir::Cache::lua.
+// Each cached chunk is named after the MD5 of the script path and starts
+// with a key line holding the Lua version, path, mtime and size, so a
+// changed script or interpreter simply misses. The cache is best effort,
+// any failure falls back to compiling the script and leaves no error.
+int Lua::LoadFile(const string &File)
+{
+   string CacheDir = _config->FindFile("Dir::Cache::lua");
+   struct stat St;
+   if (CacheDir.empty() == true || stat(File.c_str(), &St) != 0)
+      return luaL_loadfile(L, File.c_str());
+   if (CacheDir[CacheDir.length()-1] != '/')
+      CacheDir += '/';
+
+   MD5Summation Sum;
+   Sum.Add(File.c_str());
+   string CacheFile = CacheDir + Sum.Result() + ".luac";
+
+   char S[100];
+   snprintf(S, sizeof(S), " %lu %lu\n", (unsigned long)St.st_mtime,
+	    (unsigned long)St.st_size);
+   string Key = string(LUA_VERSION) + " " + File + S;
+   string ChunkName = "@" + File;
+
+   string Chunk;
+   if (AptAux_ReadChunk(CacheFile, Key, Chunk) == true) {
+      if (luaL_loadbuffer(L, Chunk.data() + Key.length(),
+			  Chunk.length() - Key.length(),
+			  ChunkName.c_str()) == 0)
+	 return 0;
+      // Stale or foreign bytecode, rebuild it below
+      lua_pop(L, 1);
+   }
+
+   int Ret = luaL_loadfile(L, File.c_str());
+   if (Ret != 0)
+      return Ret;
+
+   Chunk = Key;
+   if (lua_dump(L, AptAux_ChunkWriter, &Chunk) != 0)
+      return 0;
+   mkdir(CacheDir.c_str(), 0755);
+   string TmpFile = CacheFile + ".new";
+   int Fd = open(TmpFile.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+   if (Fd < 0)
+      return 0;
+   bool Ok = (write(Fd, Chunk.data(), Chunk.length()) ==
+	      (ssize_t)Chunk.length());
+   if (close(Fd) != 0 || Ok == false ||
+       rename(TmpFile.c_str(), CacheFile.c_str()) != 0)
+      unlink(TmpFile.c_str());
+   return 0;
+}
+
 bool Lua::RunScripts(const char *ConfListKey, bool CacheChunks)
 {
    lua_pushstring(L, CACHE_KEY);
@@ -194,10 +292,11 @@ bool Lua::RunScripts(const char *ConfListKey, bool CacheChunks)
 	    if (FileExists(File) == false)
 	       continue;
 	 }
-	 if (luaL_loadfile(L, File.c_str()) != 0) {
+	 if (LoadFile(File) != 0) {
 	    _error->Warning(_("Error loading script: %s"),
 			    lua_tostring(L, -1));
 	    lua_pop(L, 1);
+	    continue;
 	 }
 	 lua_rawseti(L, -2, ++Count);
       }
@@ -583,9 +682,28 @@ void Lua::SetDepCache(pkgDepCache *DepCache_)
 {
    DepCache = DepCache_;
    if (DepCache != NULL)
-      Cache = &DepCache->GetCache();
+      SetCache(&DepCache->GetCache());
    else
-      Cache = NULL;
+      SetCache(NULL);
+}
+
+void Lua::SetCache(pkgCache *Cache_)
+{
+   // A reopened cache may land at the same address, so always drop
+   // the parsers of the old one and start a new generation
+   delete Records;
+   Records = NULL;
+   RecordsCache = NULL;
+   Cache = Cache_;
+   CacheGeneration++;
+}
+
+void Lua::ResetCaches()
+{
+   DepCache = NULL;
+   SetCache(NULL);
+   Fix = NULL;
+   DontFix = false;
 }
 
 void Lua::SetCacheControl(LuaCacheControl *CacheControl_)
@@ -615,6 +733,19 @@ pkgCache *Lua::GetCache(lua_State *L)
    return Cache;
 }
 
+pkgRecords *Lua::GetRecords(lua_State *L)
+{
+   pkgCache *Cache = GetCache(L);
+   if (Cache == NULL)
+      return NULL;
+   if (Records == NULL || RecordsCache != Cache) {
+      delete Records;
+      Records = new pkgRecords(*Cache);
+      RecordsCache = Cache;
+   }
+   return Records;
+}
+
 inline pkgCache::Package *AptAux_ToPackage(lua_State *L, int n)
 {
    if (lua_isstring(L, n)) {
@@ -883,6 +1014,116 @@ static int AptLua_pkglist(lua_State *L)
    return 1;
 }
 
+// Iterators handed to Lua are C closures with their state in a userdata
+// upvalue, so walking the cache never builds a table of every package.
+// The state remembers the generation of the cache it was made for, as a
+// reopened cache would leave the iterator pointing into freed memory even
+// when it got the same address.
+template<class Iter>
+struct AptAux_IterState
+{
+   unsigned long Generation;
+   Iter I;
+   int Filter;
+
+   AptAux_IterState(unsigned long Generation, const Iter &I, int Filter) :
+	 Generation(Generation), I(I), Filter(Filter) {}
+};
+
+template<class Iter>
+static AptAux_IterState<Iter> *AptAux_NewIterState(lua_State *L,
+						    const Iter &I,
+						    int Filter=0)
+{
+   _lua->GetCache(L);
+   void *Mem = lua_newuserdata(L, sizeof(AptAux_IterState<Iter>));
+   return new (Mem) AptAux_IterState<Iter>(_lua->GetCacheGeneration(),
+					   I, Filter);
+}
+
+template<class Iter>
+static AptAux_IterState<Iter> *AptAux_ToIterState(lua_State *L)
+{
+   AptAux_IterState<Iter> *State = (AptAux_IterState<Iter> *)
+				lua_touserdata(L, lua_upvalueindex(1));
+   _lua->GetCache(L);
+   if (State->Generation != _lua->GetCacheGeneration()) {
+      lua_pushstring(L, "cache changed while iterating over it");
+      lua_error(L);
+   }
+   return State;
+}
+
+enum {PkgsAll, PkgsInstalled, PkgsUpgradable, PkgsBroken, PkgsNowBroken};
+
+static int AptAux_PkgsNext(lua_State *L)
+{
+   AptAux_IterState<pkgCache::PkgIterator> *State;
+   State = AptAux_ToIterState<pkgCache::PkgIterator>(L);
+   const char *Prefix = lua_tostring(L, lua_upvalueindex(2));
+   size_t PrefixLen = lua_strlen(L, lua_upvalueindex(2));
+   pkgDepCache *DepCache = NULL;
+   if (State->Filter != PkgsAll && State->Filter != PkgsInstalled)
+      DepCache = _lua->GetDepCache(L);
+   for (pkgCache::PkgIterator &PkgI = State->I;
+	PkgI.end() == false; PkgI++) {
+      if (PrefixLen != 0 && strncmp(PkgI.Name(), Prefix, PrefixLen) != 0)
+	 continue;
+      bool Match = true;
+      switch (State->Filter) {
+	 case PkgsInstalled:
+	    Match = (PkgI->CurrentVer != 0);
+	    break;
+	 case PkgsUpgradable:
+	    Match = (*DepCache)[PkgI].Upgradable();
+	    break;
+	 case PkgsBroken:
+	    Match = (*DepCache)[PkgI].InstBroken();
+	    break;
+	 case PkgsNowBroken:
+	    Match = (*DepCache)[PkgI].NowBroken();
+	    break;
+      }
+      if (Match == false)
+	 continue;
+      pushudata(pkgCache::Package*, PkgI);
+      PkgI++;
+      return 1;
+   }
+   return 0;
+}
+
+static int AptLua_pkgs(lua_State *L)
+{
+   const char *FilterStr = luaL_optstring(L, 1, "all");
+   const char *Prefix = luaL_optstring(L, 2, "");
+   int Filter;
+   if (strcmp(FilterStr, "all") == 0)
+      Filter = PkgsAll;
+   else if (strcmp(FilterStr, "installed") == 0)
+      Filter = PkgsInstalled;
+   else if (strcmp(FilterStr, "upgradable") == 0)
+      Filter = PkgsUpgradable;
+   else if (strcmp(FilterStr, "broken") == 0)
+      Filter = PkgsBroken;
+   else if (strcmp(FilterStr, "nowbroken") == 0)
+      Filter = PkgsNowBroken;
+   else
+      return luaL_argerror(L, 1, "invalid filter");
+   // Open the depcache before taking the cache, opening it may replace it
+   if (Filter != PkgsAll && Filter != PkgsInstalled) {
+      if (_lua->GetDepCache(L) == NULL)
+	 return 0;
+   }
+   pkgCache *Cache = _lua->GetCache(L);
+   if (Cache == NULL)
+      return 0;
+   AptAux_NewIterState(L, Cache->PkgBegin(), Filter);
+   lua_pushstring(L, Prefix);
+   lua_pushcclosure(L, AptAux_PkgsNext, 2);
+   return 1;
+}
+
 static int AptLua_pkgname(lua_State *L)
 {
    pkgCache::Package *Pkg = AptAux_ToPackage(L, 1);
@@ -908,12 +1149,10 @@ static int AptLua_pkgsummary(lua_State *L)
    if ((*PkgI)->VersionList == 0) {
       lua_pushstring(L, "");
    } else {
-      pkgCache *Cache = _lua->GetCache(L);
-      if (Cache == NULL)
+      pkgRecords *Recs = _lua->GetRecords(L);
+      if (Recs == NULL)
 	 return 0;
-      pkgRecords Recs(*Cache);
-      pkgRecords::Parser &Parse = 
-			      Recs.Lookup(PkgI->VersionList().FileList());
+      pkgRecords::Parser &Parse = Recs->Lookup(PkgI->VersionList().FileList());
       lua_pushstring(L, Parse.ShortDesc().c_str());
    }
    return 1;
@@ -927,16 +1166,56 @@ static int AptLua_pkgdescr(lua_State *L)
    if ((*PkgI)->VersionList == 0) {
       lua_pushstring(L, "");
    } else {
-      pkgCache *Cache = _lua->GetCache(L);
-      if (Cache == NULL)
+      pkgRecords *Recs = _lua->GetRecords(L);
+      if (Recs == NULL)
 	 return 0;
-      pkgRecords Recs(*Cache);
-      pkgRecords::Parser &Parse = Recs.Lookup(PkgI->VersionList().FileList());
+      pkgRecords::Parser &Parse = Recs->Lookup(PkgI->VersionList().FileList());
       lua_pushstring(L, Parse.LongDesc().c_str());
    }
    return 1;
 }
 
+// Push a table with the short or long description of every package in
+// the list at the top of the stack, in the same order
+static int AptAux_PushDescrList(lua_State *L, bool Long)
+{
+   luaL_checktype(L, 1, LUA_TTABLE);
+   pkgCache *Cache = _lua->GetCache(L);
+   pkgRecords *Recs = _lua->GetRecords(L);
+   if (Cache == NULL || Recs == NULL)
+      return 0;
+   int Total = luaL_getn(L, 1);
+   lua_newtable(L);
+   for (int i = 1; i <= Total; i++) {
+      lua_rawgeti(L, 1, i);
+      pkgCache::Package *Pkg = AptAux_ToPackage(L, -1);
+      lua_pop(L, 1);
+      if (Pkg == NULL || Pkg->VersionList == 0) {
+	 lua_pushstring(L, "");
+      } else {
+	 pkgCache::PkgIterator PkgI(*Cache, Pkg);
+	 pkgRecords::Parser &Parse =
+			      Recs->Lookup(PkgI.VersionList().FileList());
+	 if (Long == true)
+	    lua_pushstring(L, Parse.LongDesc().c_str());
+	 else
+	    lua_pushstring(L, Parse.ShortDesc().c_str());
+      }
+      lua_rawseti(L, -2, i);
+   }
+   return 1;
+}
+
+static int AptLua_pkgsummarylist(lua_State *L)
+{
+   return AptAux_PushDescrList(L, false);
+}
+
+static int AptLua_pkgdescrlist(lua_State *L)
+{
+   return AptAux_PushDescrList(L, true);
+}
+
 static int AptLua_pkgisvirtual(lua_State *L)
 {
    pkgCache::Package *Pkg = AptAux_ToPackage(L, 1);
@@ -1050,6 +1329,67 @@ static int AptLua_verisonline(lua_State *L)
    return Ret;
 }
 
+static void AptAux_PushProvides(lua_State *L, pkgCache::PrvIterator &PrvI)
+{
+   lua_newtable(L);
+   lua_pushstring(L, "pkg");
+   pushudata(pkgCache::Package*, PrvI.ParentPkg());
+   lua_settable(L, -3);
+   lua_pushstring(L, "name");
+   lua_pushstring(L, PrvI.Name());
+   lua_settable(L, -3);
+#ifndef DEAD
+   lua_pushstring(L, "version");
+   if (PrvI.ProvideVersion())
+      lua_pushstring(L, PrvI.ProvideVersion());
+   else
+      lua_pushstring(L, "");
+   lua_settable(L, -3);
+#endif
+   lua_pushstring(L, "verstr");
+   if (PrvI.ProvideVersion())
+      lua_pushstring(L, PrvI.ProvideVersion());
+   else
+      lua_pushstring(L, "");
+   lua_settable(L, -3);
+}
+
+static void AptAux_PushDepends(lua_State *L, pkgCache::DepIterator &DepI)
+{
+   const char *TypeStr[] = {
+      "", "depends", "predepends", "suggests", "recommends",
+      "conflicts", "replaces", "obsoletes"
+   };
+   lua_newtable(L);
+   lua_pushstring(L, "pkg");
+   pushudata(pkgCache::Package*, DepI.TargetPkg());
+   lua_settable(L, -3);
+   lua_pushstring(L, "name");
+   lua_pushstring(L, DepI.TargetPkg().Name());
+   lua_settable(L, -3);
+   lua_pushstring(L, "verstr");
+   if (DepI.TargetVer())
+      lua_pushstring(L, DepI.TargetVer());
+   else
+      lua_pushstring(L, "");
+   lua_settable(L, -3);
+   lua_pushstring(L, "operator");
+   lua_pushstring(L, DepI.CompType());
+   lua_settable(L, -3);
+   lua_pushstring(L, "type");
+   lua_pushstring(L, TypeStr[DepI->Type]);
+   lua_settable(L, -3);
+   lua_pushstring(L, "verlist");
+   lua_newtable(L);
+   pkgCache::Version **VerList = DepI.AllTargets();
+   for (int j = 0; VerList[j]; j++) {
+      pushudata(pkgCache::Version*, VerList[j]);
+      lua_rawseti(L, -2, j+1);
+   }
+   delete[] VerList;
+   lua_settable(L, -3);
+}
+
 static int AptLua_verprovlist(lua_State *L)
 {
    pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
@@ -1059,27 +1399,7 @@ static int AptLua_verprovlist(lua_State *L)
    lua_newtable(L);
    int i = 1;
    for (; PrvI.end() == false; PrvI++) {
-      lua_newtable(L);
-      lua_pushstring(L, "pkg");
-      pushudata(pkgCache::Package*, PrvI.ParentPkg());
-      lua_settable(L, -3);
-      lua_pushstring(L, "name");
-      lua_pushstring(L, PrvI.Name());
-      lua_settable(L, -3);
-#ifndef DEAD
-      lua_pushstring(L, "version");
-      if (PrvI.ProvideVersion())
-         lua_pushstring(L, PrvI.ProvideVersion());
-      else
-         lua_pushstring(L, "");
-      lua_settable(L, -3);
-#endif
-      lua_pushstring(L, "verstr");
-      if (PrvI.ProvideVersion())
-         lua_pushstring(L, PrvI.ProvideVersion());
-      else
-         lua_pushstring(L, "");
-      lua_settable(L, -3);
+      AptAux_PushProvides(L, PrvI);
       lua_rawseti(L, -2, i++);
    }
    delete VerI;
@@ -1088,10 +1408,6 @@ static int AptLua_verprovlist(lua_State *L)
 
 static int AptLua_verdeplist(lua_State *L)
 {
-   const char *TypeStr[] = {
-      "", "depends", "predepends", "suggests", "recommends",
-      "conflicts", "replaces", "obsoletes"
-   };
    pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
    if (VerI == NULL)
       return 0;
@@ -1099,37 +1415,147 @@ static int AptLua_verdeplist(lua_State *L)
    lua_newtable(L);
    int i = 1;
    for (; DepI.end() == false; DepI++) {
+      AptAux_PushDepends(L, DepI);
+      lua_rawseti(L, -2, i++);
+   }
+   delete VerI;
+   return 1;
+}
+
+static int AptAux_ProvidesNext(lua_State *L)
+{
+   AptAux_IterState<pkgCache::PrvIterator> *State;
+   State = AptAux_ToIterState<pkgCache::PrvIterator>(L);
+   if (State->I.end() == true)
+      return 0;
+   AptAux_PushProvides(L, State->I);
+   State->I++;
+   return 1;
+}
+
+static int AptLua_verprovs(lua_State *L)
+{
+   pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
+   if (VerI == NULL)
+      return 0;
+   AptAux_NewIterState(L, VerI->ProvidesList());
+   delete VerI;
+   lua_pushcclosure(L, AptAux_ProvidesNext, 1);
+   return 1;
+}
+
+static int AptAux_DependsNext(lua_State *L)
+{
+   AptAux_IterState<pkgCache::DepIterator> *State;
+   State = AptAux_ToIterState<pkgCache::DepIterator>(L);
+   if (State->I.end() == true)
+      return 0;
+   AptAux_PushDepends(L, State->I);
+   State->I++;
+   return 1;
+}
+
+static int AptLua_verdeps(lua_State *L)
+{
+   pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
+   if (VerI == NULL)
+      return 0;
+   AptAux_NewIterState(L, VerI->DependsList());
+   delete VerI;
+   lua_pushcclosure(L, AptAux_DependsNext, 1);
+   return 1;
+}
+
+// Push the fields of the record of a version named by the arguments
+// after it, or all of them. The relations come as lists of tables like
+// the ones of verdeplist, so scripts can filter on the records without
+// having them rendered as text.
+static int AptLua_verrecord(lua_State *L)
+{
+   const char *AllTags[] = {
+      "Package", "Section", "Installed Size", "Packager", "Version",
+      "Pre-Depends", "Depends", "Conflicts", "Provides", "Obsoletes",
+      "Architecture", "Size", "Hash", "Filename", "Summary",
+      "Description", NULL
+   };
+   pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
+   if (VerI == NULL)
+      return 0;
+   pkgRecords *Recs = _lua->GetRecords(L);
+   if (Recs == NULL) {
+      delete VerI;
+      return 0;
+   }
+   pkgRecords::Parser &Parse = Recs->Lookup(VerI->FileList());
+   delete VerI;
+
+   vector<string> Tags;
+   int Top = lua_gettop(L);
+   for (int i = 2; i <= Top; i++)
+      Tags.push_back(luaL_checkstring(L, i));
+   if (Tags.empty() == true)
+      Tags.assign(AllTags, AllTags + sizeof(AllTags)/sizeof(*AllTags) - 1);
+
+   const char *TypeStr[] = {
+      "", "depends", "predepends", "suggests", "recommends",
+      "conflicts", "replaces", "obsoletes", "provides"
+   };
+   lua_newtable(L);
+   vector<pkgRecordDep> Deps;
+   unsigned int DepsType = 0;
+   for (vector<string>::const_iterator T = Tags.begin();
+	T != Tags.end(); T++) {
+      unsigned int Type = 0;
+      if (strcasecmp(T->c_str(), "Pre-Depends") == 0)
+	 Type = pkgCache::Dep::PreDepends;
+      else if (strcasecmp(T->c_str(), "Depends") == 0)
+	 Type = pkgCache::Dep::Depends;
+      else if (strcasecmp(T->c_str(), "Conflicts") == 0)
+	 Type = pkgCache::Dep::Conflicts;
+      else if (strcasecmp(T->c_str(), "Provides") == 0)
+	 Type = pkgCache::Dep::Provides;
+      else if (strcasecmp(T->c_str(), "Obsoletes") == 0)
+	 Type = pkgCache::Dep::Obsoletes;
+
+      lua_pushstring(L, T->c_str());
+      if (Type == 0) {
+	 lua_pushstring(L, Parse.Field(*T).c_str());
+	 lua_settable(L, -3);
+	 continue;
+      }
+
+      // Depends and Pre-Depends are read together
+      unsigned int ReadType = Type;
+      if (ReadType == pkgCache::Dep::PreDepends)
+	 ReadType = pkgCache::Dep::Depends;
+      if (ReadType != DepsType) {
+	 Deps.clear();
+	 Parse.Depends(ReadType, Deps);
+	 DepsType = ReadType;
+      }
       lua_newtable(L);
-      lua_pushstring(L, "pkg");
-      pushudata(pkgCache::Package*, DepI.TargetPkg());
-      lua_settable(L, -3);
-      lua_pushstring(L, "name");
-      lua_pushstring(L, DepI.TargetPkg().Name());
-      lua_settable(L, -3);
-      lua_pushstring(L, "verstr");
-      if (DepI.TargetVer())
-         lua_pushstring(L, DepI.TargetVer());
-      else
-         lua_pushstring(L, "");
-      lua_settable(L, -3);
-      lua_pushstring(L, "operator");
-      lua_pushstring(L, DepI.CompType());
-      lua_settable(L, -3);
-      lua_pushstring(L, "type");
-      lua_pushstring(L, TypeStr[DepI->Type]);
-      lua_settable(L, -3);
-      lua_pushstring(L, "verlist");
-      lua_newtable(L);
-      pkgCache::Version **VerList = DepI.AllTargets();
-      for (int j = 0; VerList[j]; j++) {
-	 pushudata(pkgCache::Version*, VerList[j]);
-	 lua_rawseti(L, -2, j+1);
+      int i = 1;
+      for (vector<pkgRecordDep>::const_iterator D = Deps.begin();
+	   D != Deps.end(); D++) {
+	 if (D->Type != Type)
+	    continue;
+	 lua_newtable(L);
+	 lua_pushstring(L, "name");
+	 lua_pushstring(L, D->Name.c_str());
+	 lua_settable(L, -3);
+	 lua_pushstring(L, "verstr");
+	 lua_pushstring(L, D->Version.c_str());
+	 lua_settable(L, -3);
+	 lua_pushstring(L, "operator");
+	 lua_pushstring(L, pkgCache::CompType(D->Op));
+	 lua_settable(L, -3);
+	 lua_pushstring(L, "type");
+	 lua_pushstring(L, TypeStr[D->Type]);
+	 lua_settable(L, -3);
+	 lua_rawseti(L, -2, i++);
       }
-      delete[] VerList;
       lua_settable(L, -3);
-      lua_rawseti(L, -2, i++);
    }
-   delete VerI;
    return 1;
 }
 
@@ -1138,15 +1564,18 @@ static int AptLua_verfilelist(lua_State *L)
    pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
    if (VerI == NULL)
       return 0;
-   pkgCache *Cache = _lua->GetCache(L);
-   if (Cache == NULL)
+   pkgRecords *Recs = _lua->GetRecords(L);
+   if (Recs == NULL) {
+      delete VerI;
       return 0;
-   pkgRecords Recs(*Cache);
-   pkgRecords::Parser &Parse = Recs.Lookup(VerI->FileList());
+   }
+   pkgRecords::Parser &Parse = Recs->Lookup(VerI->FileList());
 
    vector<string> Files;
-   if (Parse.FileList(Files) == false)
+   if (Parse.FileList(Files) == false) {
+      delete VerI;
       return 0;
+   }
 
    lua_newtable(L);
    int i = 1;
@@ -1164,15 +1593,18 @@ static int AptLua_verchangeloglist(lua_State *L)
    pkgCache::VerIterator *VerI = AptAux_ToVerIterator(L, 1);
    if (VerI == NULL)
       return 0;
-   pkgCache *Cache = _lua->GetCache(L);
-   if (Cache == NULL)
+   pkgRecords *Recs = _lua->GetRecords(L);
+   if (Recs == NULL) {
+      delete VerI;
       return 0;
-   pkgRecords Recs(*Cache);
-   pkgRecords::Parser &Parse = Recs.Lookup(VerI->FileList());
+   }
+   pkgRecords::Parser &Parse = Recs->Lookup(VerI->FileList());
 
    vector<ChangeLogEntry *> ChangeLog;
-   if (Parse.ChangeLog(ChangeLog) == false)
+   if (Parse.ChangeLog(ChangeLog) == false) {
+      delete VerI;
       return 0;
+   }
 
    lua_newtable(L);
    int i = 1;
@@ -1486,10 +1918,13 @@ static const luaL_reg aptlib[] = {
    {"confclear",	AptLua_confclear},
    {"pkgfind",		AptLua_pkgfind},
    {"pkglist",		AptLua_pkglist},
+   {"pkgs",		AptLua_pkgs},
    {"pkgname",		AptLua_pkgname},
    {"pkgid",		AptLua_pkgid},
    {"pkgsummary",	AptLua_pkgsummary},
    {"pkgdescr",		AptLua_pkgdescr},
+   {"pkgsummarylist",	AptLua_pkgsummarylist},
+   {"pkgdescrlist",	AptLua_pkgdescrlist},
    {"pkgisvirtual",	AptLua_pkgisvirtual},
    {"pkgvercur",	AptLua_pkgvercur},
    {"pkgverinst",	AptLua_pkgverinst},
@@ -1502,6 +1937,9 @@ static const luaL_reg aptlib[] = {
    {"verisonline",	AptLua_verisonline},
    {"verprovlist",   	AptLua_verprovlist},
    {"verdeplist",   	AptLua_verdeplist},
+   {"verprovs",		AptLua_verprovs},
+   {"verdeps",		AptLua_verdeps},
+   {"verrecord",	AptLua_verrecord},
    {"verfilelist",   	AptLua_verfilelist},
    {"verchangeloglist", AptLua_verchangeloglist},
    {"verstrcmp",	AptLua_verstrcmp},
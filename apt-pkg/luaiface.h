@@ -16,6 +16,7 @@ using std::string;
 
 class pkgDepCache;
 class pkgProblemResolver;
+class pkgRecords;
 class lua_State;
 typedef int (*lua_CFunction)(struct lua_State*);
 
@@ -39,6 +40,12 @@ class Lua {
 
    pkgDepCache *DepCache;
    pkgCache *Cache;
+   // Bumped by SetCache, iterators handed to scripts check it
+   unsigned long CacheGeneration;
+
+   // Record parsers are expensive to set up, so they live as long as Cache
+   pkgRecords *Records;
+   pkgCache *RecordsCache;
 
    LuaCacheControl *CacheControl;
 
@@ -46,6 +53,7 @@ class Lua {
    bool DontFix;
 
    void InternalRunScript();
+   int LoadFile(const string &File);
 
    public:
 
@@ -92,16 +100,17 @@ class Lua {
    vector<pkgCache::Package*> GetGlobalPkgList(const char *Name);
 
    void SetDepCache(pkgDepCache *DepCache_);
-   void SetCache(pkgCache *Cache_) { Cache = Cache_; }
+   void SetCache(pkgCache *Cache_);
    void SetCacheControl(LuaCacheControl *CacheControl_);
    void SetProblemResolver(pkgProblemResolver *Fix_) { Fix = Fix_; }
    void SetDontFix() { DontFix = true; }
-   void ResetCaches()
-      { DepCache = NULL; Cache = NULL; Fix = NULL; DontFix = false; }
+   void ResetCaches();
 
    // For API functions
    pkgDepCache *GetDepCache(lua_State *L=NULL);
    pkgCache *GetCache(lua_State *L=NULL);
+   unsigned long GetCacheGeneration() { return CacheGeneration; }
+   pkgRecords *GetRecords(lua_State *L=NULL);
    LuaCacheControl *GetCacheControl() { return CacheControl; }
    pkgProblemResolver *GetProblemResolver() { return Fix; }
    bool GetDontFix() { return DontFix; }
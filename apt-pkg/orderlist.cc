@@ -69,6 +69,7 @@
 #include <apt-pkg/version.h>
 #include <apt-pkg/sptr.h>
 #include <apt-pkg/configuration.h>
+#include <apt-pkg/profile.h>
 
 #include <iostream>
 									/*}}}*/
@@ -174,6 +175,7 @@ bool pkgOrderList::DoRun()
    fatal and indicate that the packages cannot be installed. */
 bool pkgOrderList::OrderCritical()
 {
+   ProfileTimer Timer("pkgOrderList::OrderCritical");
    FileList = 0;
    
    Primary = &pkgOrderList::DepUnPackPre;
@@ -200,6 +202,7 @@ bool pkgOrderList::OrderCritical()
    suitable for unpacking */
 bool pkgOrderList::OrderUnpack(string *FileList)
 {
+   ProfileTimer Timer("pkgOrderList::OrderUnpack");
    this->FileList = FileList;
 
    // Setup the after flags
@@ -273,6 +276,7 @@ bool pkgOrderList::OrderUnpack(string *FileList)
    for configuration */
 bool pkgOrderList::OrderConfigure()
 {
+   ProfileTimer Timer("pkgOrderList::OrderConfigure");
    FileList = 0;
    Primary = &pkgOrderList::DepConfigure;
    Secondary = 0;
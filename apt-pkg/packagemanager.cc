@@ -22,9 +22,14 @@
 #include <apt-pkg/algorithms.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/sptr.h>
+#include <apt-pkg/fileutl.h>
     
 #include <apti18n.h>    
 #include <iostream>
+#include <stdio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 									/*}}}*/
 
 using namespace std;
@@ -32,7 +37,8 @@ using namespace std;
 // PM::PackageManager - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* */
-pkgPackageManager::pkgPackageManager(pkgDepCache *pCache) : Cache(*pCache)
+pkgPackageManager::pkgPackageManager(pkgDepCache *pCache) : Cache(*pCache),
+                     Archives(0), ArchiveNames(0), InstallPid(0), Ordered(false)
 {
    FileNames = new string[Cache.Head().PackageCount];
    List = 0;
@@ -44,15 +50,20 @@ pkgPackageManager::pkgPackageManager(pkgDepCache *pCache) : Cache(*pCache)
 /* */
 pkgPackageManager::~pkgPackageManager()
 {
+   WaitInstall(true);
    delete List;
    delete [] FileNames;
+   delete [] Archives;
+   delete [] ArchiveNames;
 }
 									/*}}}*/
 // PM::GetArchives - Queue the archives for download			/*{{{*/
 // ---------------------------------------------------------------------
-/* */
+/* For a pipelined installation the file names are kept aside and only
+   published in FileNames by CollectArchives once an archive is complete,
+   so the ordering sees which changes can be done already. */
 bool pkgPackageManager::GetArchives(pkgAcquire *Owner,pkgSourceList *Sources,
-				    pkgRecords *Recs)
+				    pkgRecords *Recs,bool Pipelined)
 {
    if (CreateOrderList() == false)
       return false;
@@ -60,6 +71,18 @@ bool pkgPackageManager::GetArchives(pkgAcquire *Owner,pkgSourceList *Sources,
    if (List->OrderUnpack() == false)
       return _error->Error("Internal ordering error");
 
+   EndPipeline();
+   delete [] ArchiveNames;
+   ArchiveNames = 0;
+   if (Pipelined == true)
+   {
+      unsigned long Count = Cache.Head().PackageCount;
+      Archives = new pkgAcqArchive *[Count];
+      for (unsigned long I = 0; I != Count; I++)
+	 Archives[I] = 0;
+      ArchiveNames = new string[Count];
+   }
+
    for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
    {
       PkgIterator Pkg(Cache,*I);
@@ -78,8 +101,16 @@ bool pkgPackageManager::GetArchives(pkgAcquire *Owner,pkgSourceList *Sources,
       if (List->IsNow(Pkg) == false)
 	 continue;
 	 
-      new pkgAcqArchive(Owner,Sources,Recs,Cache[Pkg].InstVerIter(Cache),
-			FileNames[Pkg->ID]);
+      if (Archives == 0)
+      {
+	 new pkgAcqArchive(Owner,Sources,Recs,Cache[Pkg].InstVerIter(Cache),
+			   FileNames[Pkg->ID]);
+	 continue;
+      }
+
+      Archives[Pkg->ID] = new pkgAcqArchive(Owner,Sources,Recs,
+					    Cache[Pkg].InstVerIter(Cache),
+					    ArchiveNames[Pkg->ID]);
    }
 
    return true;
@@ -233,7 +264,9 @@ bool pkgPackageManager::ConfigureAll()
    // Populate the order list
    for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
       if (List->IsFlag(pkgCache::PkgIterator(Cache,*I),
-		       pkgOrderList::UnPacked) == true)
+		       pkgOrderList::UnPacked) == true &&
+	  List->IsFlag(pkgCache::PkgIterator(Cache,*I),
+		       pkgOrderList::Configured) == false)
 	 OList.push_back(*I);
    
    if (OList.OrderConfigure() == false)
@@ -587,7 +620,16 @@ pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
    if (Debug == true)
       clog << "Done ordering" << endl;
 
+   // A pipelined installation only does the sets of changes that have
+   // all their archives, the others are left for a later run
+   vector<map_ptrloc> Set;
+   vector<bool> Ready;
+   if (Archives != 0)
+      GroupChanges(Set,Ready);
+
    bool DoneSomething = false;
+   bool Skipped = false;
+   Ordered = false;
    for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
    {
       PkgIterator Pkg(Cache,*I);
@@ -598,8 +640,16 @@ pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
 	    clog << "Skipping already done " << Pkg.Name() << endl;
 	 continue;
       }
-      
-      if (List->IsMissing(Pkg) == true)
+
+      if (Archives != 0)
+      {
+	 if (Ready[Set[Pkg->ID]] == false)
+	 {
+	    Skipped = true;
+	    continue;
+	 }
+      }
+      else if (List->IsMissing(Pkg) == true)
       {
 	 if (Debug == true)
 	    clog << "Sequence completed at " << Pkg.Name() << endl;
@@ -637,6 +687,10 @@ pkgPackageManager::OrderResult pkgPackageManager::OrderInstall()
 	    return Failed;
       DoneSomething = true;
    }
+
+   Ordered = DoneSomething;
+   if (Skipped == true)
+      return Incomplete;
    
    // Final run through the configure phase
    if (ConfigureAll() == false)
@@ -670,17 +724,259 @@ pkgPackageManager::OrderResult pkgPackageManager::DoInstall(InstProgress *Prog)
    return Res;
 }
 									/*}}}*/
+static InstProgress *NewInstProgress()
+{
+   if (_config->FindB("RPM::Interactive",true))
+      return new InstHashProgress(*_config);
+   return new InstPercentProgress(*_config);
+}
+
 pkgPackageManager::OrderResult pkgPackageManager::DoInstall()
 {
-   InstProgress *Prog;
+   InstProgress *Prog = NewInstProgress();
    pkgPackageManager::OrderResult res;
-   if (_config->FindB("RPM::Interactive",true)) {
-      Prog = new InstHashProgress(*_config);
-   } else {
-      Prog = new InstPercentProgress(*_config);
-   }
    res = DoInstall(Prog);
    delete Prog;
    return res; 
+}
+									/*}}}*/
+// PM::GroupChanges - Split the changes into dependency closed sets	/*{{{*/
+// ---------------------------------------------------------------------
+/* Two changed packages share a set when one depends on, conflicts with
+   or obsoletes the other, or when they provide the same name and thus
+   may stand in for each other in a dependency of an unchanged package.
+   Doing whole sets at a time keeps every intermediate state of a
+   pipelined installation as consistent as the final one. Set maps each
+   changed package to the ID of its set and Ready tells for every set if
+   all of its archives are present. */
+static map_ptrloc FindSet(vector<map_ptrloc> &Set,map_ptrloc ID)
+{
+   while (Set[ID] != ID)
+      ID = Set[ID] = Set[Set[ID]];
+   return ID;
+}
+
+static void JoinSets(vector<map_ptrloc> &Set,map_ptrloc A,map_ptrloc B)
+{
+   Set[FindSet(Set,A)] = FindSet(Set,B);
+}
+
+void pkgPackageManager::GroupChanges(vector<map_ptrloc> &Set,
+				     vector<bool> &Ready)
+{
+   unsigned long Count = Cache.Head().PackageCount;
+   vector<bool> Changed(Count,false);
+   Set.resize(Count);
+   for (unsigned long I = 0; I != Count; I++)
+      Set[I] = I;
+   for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
+      if (List->IsNow(PkgIterator(Cache,*I)) == true)
+	 Changed[(*I)->ID] = true;
+
+   for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
+   {
+      PkgIterator Pkg(Cache,*I);
+      if (Changed[Pkg->ID] == false)
+	 continue;
+
+      VerIterator Vers[2] = {Cache[Pkg].InstVerIter(Cache),Pkg.CurrentVer()};
+      for (int V = 0; V != 2; V++)
+      {
+	 if (Vers[V].end() == true)
+	    continue;
+
+	 for (DepIterator D = Vers[V].DependsList(); D.end() == false; D++)
+	 {
+	    if (D->Type != pkgCache::Dep::Depends &&
+		D->Type != pkgCache::Dep::PreDepends &&
+		D->Type != pkgCache::Dep::Conflicts &&
+		D->Type != pkgCache::Dep::Obsoletes)
+	       continue;
+
+	    PkgIterator Target = D.TargetPkg();
+	    if (Changed[Target->ID] == true)
+	       JoinSets(Set,Pkg->ID,Target->ID);
+	    for (PrvIterator P = Target.ProvidesList(); P.end() == false; P++)
+	       if (Changed[P.OwnerPkg()->ID] == true)
+		  JoinSets(Set,Pkg->ID,P.OwnerPkg()->ID);
+	 }
+
+	 for (PrvIterator P = Vers[V].ProvidesList(); P.end() == false; P++)
+	 {
+	    PkgIterator Name = P.ParentPkg();
+	    if (Changed[Name->ID] == true)
+	       JoinSets(Set,Pkg->ID,Name->ID);
+	    for (PrvIterator O = Name.ProvidesList(); O.end() == false; O++)
+	       if (Changed[O.OwnerPkg()->ID] == true)
+		  JoinSets(Set,Pkg->ID,O.OwnerPkg()->ID);
+	 }
+      }
+   }
+
+   Ready.assign(Count,true);
+   for (pkgOrderList::iterator I = List->begin(); I != List->end(); I++)
+   {
+      PkgIterator Pkg(Cache,*I);
+      if (Changed[Pkg->ID] == false)
+	 continue;
+      Set[Pkg->ID] = FindSet(Set,Pkg->ID);
+      if (List->IsMissing(Pkg) == true)
+	 Ready[Set[Pkg->ID]] = false;
+   }
+}
+									/*}}}*/
+// PM::CollectArchives - Publish the archives that are complete	/*{{{*/
+// ---------------------------------------------------------------------
+/* Returns the number of archives that became available since the last
+   call. */
+unsigned long pkgPackageManager::CollectArchives()
+{
+   if (Archives == 0)
+      return 0;
+
+   unsigned long Collected = 0;
+   unsigned long Count = Cache.Head().PackageCount;
+   for (unsigned long I = 0; I != Count; I++)
+   {
+      if (Archives[I] == 0)
+	 continue;
+      if (Archives[I]->Status == pkgAcquire::Item::StatDone &&
+	  Archives[I]->Complete == true)
+      {
+	 FileNames[I] = ArchiveNames[I];
+	 Archives[I] = 0;
+	 Collected++;
+      }
+      else if (Archives[I]->Status == pkgAcquire::Item::StatError)
+	 Archives[I] = 0;
+   }
+   return Collected;
+}
+									/*}}}*/
+// PM::InstallReady - Install the sets of changes that are complete	/*{{{*/
+// ---------------------------------------------------------------------
+/* The ordering is done here, so the states in the order list follow
+   what is being installed, while the package manager itself runs in a
+   child process. WaitInstall collects its result. */
+pkgPackageManager::OrderResult pkgPackageManager::InstallReady()
+{
+   if (Installing() == true)
+      return Incomplete;
+
+   OrderResult Res = OrderInstall();
+   if (Res == Failed || Ordered == false)
+      return Res;
+
+   if (Debug == true)
+      clog << "Starting a pipelined installation run" << endl;
+
+   cout << flush;
+   InstallPid = ExecFork();
+   if (InstallPid == 0)
+   {
+      Progress = NewInstProgress();
+      bool Ret = Go();
+      _error->DumpErrors();
+      cout << flush;
+      fflush(stdout);
+      _exit(Ret == true ? 0 : 100);
+   }
+   return Res;
+}
+									/*}}}*/
+// PM::WaitInstall - Collect the result of a pipelined installation run	/*{{{*/
+// ---------------------------------------------------------------------
+/* Without Block this only reaps a child that has already finished. */
+bool pkgPackageManager::WaitInstall(bool Block)
+{
+   if (InstallPid <= 0)
+      return true;
+
+   if (Block == false)
+   {
+      // Peek without reaping, ExecWait does that and reports errors
+      siginfo_t Info;
+      Info.si_pid = 0;
+      if (waitid(P_PID,InstallPid,&Info,WEXITED|WNOHANG|WNOWAIT) == 0 &&
+	  Info.si_pid == 0)
+	 return true;
+   }
+
+   pid_t Pid = InstallPid;
+   InstallPid = 0;
+   return ExecWait(Pid,"package manager");
+}
+									/*}}}*/
+// PM::EndPipeline - Stop tracking the queued archives			/*{{{*/
+// ---------------------------------------------------------------------
+/* Later orderings see every change again, like a normal installation. */
+void pkgPackageManager::EndPipeline()
+{
+   delete [] Archives;
+   Archives = 0;
+}
+									/*}}}*/
+
+// PipelinedAcquire::pkgPipelinedAcquire - Constructor			/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+pkgPipelinedAcquire::pkgPipelinedAcquire(pkgAcquireStatus *Log) :
+                     pkgAcquire(Log), PM(0), Pending(0), BatchFailed(false)
+{
+   BatchSize = _config->FindI("APT::Get::Pipeline-Batch",16);
+}
+									/*}}}*/
+// PipelinedAcquire::Pipeline - Start installing while downloading	/*{{{*/
+// ---------------------------------------------------------------------
+/* The archives must have been queued with GetArchives in pipelined
+   mode. Finish has to be called once Run is over. */
+void pkgPipelinedAcquire::Pipeline(pkgPackageManager *PM)
+{
+   this->PM = PM;
+   Pending = 0;
+   BatchFailed = false;
+}
+									/*}}}*/
+// PipelinedAcquire::RunFds - Run the next batch when it is complete	/*{{{*/
+// ---------------------------------------------------------------------
+/* This is called on every turn of the acquire loop, at least every
+   half second. A new batch is only started once BatchSize archives have
+   arrived since the last one, to keep the number of transactions down.
+   A failed batch stops the whole run, the error it left makes Run()
+   return Failed right after this. */
+void pkgPipelinedAcquire::RunFds(fd_set *RSet,fd_set *WSet)
+{
+   pkgAcquire::RunFds(RSet,WSet);
+   if (PM == 0 || BatchFailed == true || _error->PendingError() == true)
+      return;
+
+   Pending += PM->CollectArchives();
+   if (PM->WaitInstall(false) == false)
+   {
+      BatchFailed = true;
+      return;
+   }
+   if (PM->Installing() == true || Pending < BatchSize)
+      return;
+   // The batch runs in a forked child without exec
+   if (PauseLocalWorkers() == false)
+      return;
+   Pending = 0;
+   PM->InstallReady();
+   ResumeLocalWorkers();
+}
+									/*}}}*/
+// PipelinedAcquire::Finish - Wait for the running batch		/*{{{*/
+// ---------------------------------------------------------------------
+/* Whatever is left is done by the normal DoInstall afterwards. */
+bool pkgPipelinedAcquire::Finish()
+{
+   if (PM == 0)
+      return BatchFailed == false;
+   bool Ret = PM->WaitInstall(true) == true && BatchFailed == false;
+   PM->CollectArchives();
+   PM->EndPipeline();
+   PM = 0;
+   return Ret;
 }
 // vim:sts=3:sw=3
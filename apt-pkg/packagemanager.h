@@ -24,12 +24,16 @@
 #define PKGLIB_PACKAGEMANAGER_H
 
 #include <string>
+#include <vector>
+#include <sys/types.h>
 #include <apt-pkg/pkgcache.h>
 #include <apt-pkg/progress.h>
+#include <apt-pkg/acquire.h>
 
 using std::string;
+using std::vector;
 
-class pkgAcquire;
+class pkgAcqArchive;
 class pkgDepCache;
 class pkgSourceList;
 class pkgOrderList;
@@ -46,6 +50,13 @@ class pkgPackageManager : protected pkgCache::Namespace
    pkgOrderList *List;
    InstProgress *Progress;
    bool Debug;
+
+   // Pipelined installation, see pkgPipelinedAcquire
+   pkgAcqArchive **Archives;
+   string *ArchiveNames;
+   pid_t InstallPid;
+   bool Ordered;
+   void GroupChanges(vector<map_ptrloc> &Set,vector<bool> &Ready);
          
    bool DepAdd(pkgOrderList &Order,PkgIterator P,int Depth = 0);
    virtual OrderResult OrderInstall();
@@ -73,13 +84,42 @@ class pkgPackageManager : protected pkgCache::Namespace
       
    // Main action members
    bool GetArchives(pkgAcquire *Owner,pkgSourceList *Sources,
-		    pkgRecords *Recs);
+		    pkgRecords *Recs,bool Pipelined = false);
    OrderResult DoInstall(InstProgress *Prog);
    OrderResult DoInstall();
    bool FixMissing();
+
+   // Pipelined installation
+   unsigned long CollectArchives();
+   OrderResult InstallReady();
+   bool WaitInstall(bool Block);
+   inline bool Installing() {return InstallPid > 0;}
+   void EndPipeline();
    
    pkgPackageManager(pkgDepCache *Cache);
    virtual ~pkgPackageManager();
 };
 
+/* An acquire object that hands every complete, dependency closed set of
+   changes to the package manager while the remaining archives are still
+   downloading. The sets are installed in a child process, one at a time. */
+class pkgPipelinedAcquire : public pkgAcquire
+{
+   pkgPackageManager *PM;
+   unsigned long Pending;
+   unsigned long BatchSize;
+   bool BatchFailed;
+
+   protected:
+
+   virtual void RunFds(fd_set *RSet,fd_set *WSet);
+
+   public:
+
+   void Pipeline(pkgPackageManager *PM);
+   bool Finish();
+
+   pkgPipelinedAcquire(pkgAcquireStatus *Log = 0);
+};
+
 #endif
@@ -21,10 +21,12 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/sptr.h>
 #include <apt-pkg/pkgsystem.h>
+#include <apt-pkg/profile.h>
 
 #include <apti18n.h>
 
 #include <vector>
+#include <algorithm>
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -34,6 +36,9 @@
 									/*}}}*/
 typedef vector<pkgIndexFile *>::iterator FileIterator;
 
+// Read for every index file merged and every cache check
+static Configuration::Handle ReInstallOpt("APT::Get::ReInstall");
+
 // CacheGenerator::pkgCacheGenerator - Constructor			/*{{{*/
 // ---------------------------------------------------------------------
 /* We set the diry flag and make sure that is written to the disk */
@@ -104,7 +109,7 @@ bool pkgCacheGenerator::MergeList(ListParser &List,
    //		       process, the algorithm is sligthly changed to
    //		       order the "better" architectures before, even if
    //		       they are already in the system.
-   bool ReInstall = _config->FindB("APT::Get::ReInstall", false);
+   bool ReInstall = ReInstallOpt.FindB(false);
 
    unsigned int Counter = 0;
    while (List.Step() == true)
@@ -546,6 +551,97 @@ bool pkgCacheGenerator::SelectFile(const string & File, const string & Site,
    return true;
 }
 									/*}}}*/
+// CacheGenerator::SelectFile - Select a file already in the cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* This is used to merge more packages into the entry of an earlier
+   cache, see pkgIndexFile::MergeDelta */
+bool pkgCacheGenerator::SelectFile(pkgCache::PkgFileIterator File,
+				   pkgIndexFile const &Index)
+{
+   if (File.end() == true)
+      return false;
+   
+   CurrentFile = File;
+   PkgFileName = File.FileName();
+   
+   if (Progress != 0)
+      Progress->SubProgress(Index.Size());
+   return true;
+}
+									/*}}}*/
+// CacheGenerator::DropFileVers - Forget records of the selected file	/*{{{*/
+// ---------------------------------------------------------------------
+/* The records of the current file at the given offsets, which must be
+   sorted, are gone from it. They are unlinked from their versions and a
+   version they were current for is not installed anymore. A version
+   left with no record at all is unlinked from its package, and its
+   dependencies and provides from the lists of their targets. The space
+   is not reused, it is given back by the next full rebuild. */
+bool pkgCacheGenerator::DropFileVers(vector<unsigned long> const &Offsets)
+{
+   if (Offsets.empty() == true)
+      return true;
+
+   map_ptrloc File = CurrentFile - Cache.PkgFileP;
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; Pkg++)
+   {
+      map_ptrloc *LastVer = &Pkg->VersionList;
+      while (*LastVer != 0)
+      {
+	 pkgCache::Version *Ver = Cache.VerP + *LastVer;
+	 bool Dropped = false;
+	 map_ptrloc *LastVF = &Ver->FileList;
+	 while (*LastVF != 0)
+	 {
+	    pkgCache::VerFile *VF = Cache.VerFileP + *LastVF;
+	    if (VF->File == File &&
+		binary_search(Offsets.begin(),Offsets.end(),
+			      (unsigned long)VF->Offset) == true)
+	    {
+	       *LastVF = VF->NextFile;
+	       Dropped = true;
+	    }
+	    else
+	       LastVF = &VF->NextFile;
+	 }
+
+	 if (Dropped == true && Pkg->CurrentVer == *LastVer)
+	 {
+	    Pkg->CurrentVer = 0;
+	    Pkg->SelectedState = pkgCache::State::Unknown;
+	    Pkg->InstState = pkgCache::State::Ok;
+	    Pkg->CurrentState = pkgCache::State::NotInstalled;
+	 }
+
+	 if (Ver->FileList != 0)
+	 {
+	    LastVer = &Ver->NextVer;
+	    continue;
+	 }
+
+	 // Nothing has this version anymore
+	 for (map_ptrloc D = Ver->DependsList; D != 0;
+	      D = Cache.DepP[D].NextDepends)
+	 {
+	    map_ptrloc *Last = &Cache.PkgP[Cache.DepP[D].Package].RevDepends;
+	    for (; *Last != 0 && *Last != D; Last = &Cache.DepP[*Last].NextRevDepends);
+	    if (*Last == D)
+	       *Last = Cache.DepP[D].NextRevDepends;
+	 }
+	 for (map_ptrloc P = Ver->ProvidesList; P != 0;
+	      P = Cache.ProvideP[P].NextPkgProv)
+	 {
+	    map_ptrloc *Last = &Cache.PkgP[Cache.ProvideP[P].ParentPkg].ProvidesList;
+	    for (; *Last != 0 && *Last != P; Last = &Cache.ProvideP[*Last].NextProvides);
+	    if (*Last == P)
+	       *Last = Cache.ProvideP[P].NextProvides;
+	 }
+	 *LastVer = Ver->NextVer;
+      }
+   }
+   return true;
+}
+									/*}}}*/
 // CacheGenerator::WriteUniqueString - Insert a unique string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This is used to create handles to strings. Given the same text it
@@ -583,6 +679,7 @@ unsigned long pkgCacheGenerator::WriteUniqString(const char *S,
    unsigned long Item = Map.Allocate(sizeof(pkgCache::StringItem));
    if (Item == 0)
       return 0;
+   Profile::Count(Profile::StringsInterned);
 
    // Fill in the structure
    pkgCache::StringItem *ItemP = Cache.StringItemP + Item;
@@ -614,7 +711,7 @@ static bool CheckValidity(string CacheFile, FileIterator Start,
    //		       order the "better" architectures before, even if
    //		       they are already in the system. Thus, we rebuild
    //		       the cache when it's used.
-   bool ReInstall = _config->FindB("APT::Get::ReInstall", false);
+   bool ReInstall = ReInstallOpt.FindB(false);
    if (ReInstall == true)
       return false;
 
@@ -672,6 +769,75 @@ static bool CheckValidity(string CacheFile, FileIterator Start,
    return true;
 }
 									/*}}}*/
+// CheckDelta - Check if a cache only needs some changes merged		/*{{{*/
+// ---------------------------------------------------------------------
+/* This is CheckValidity for a cache whose only stale entries are of
+   index files able to merge just what changed since, like the RPM
+   database after a transaction. Those
+   files are returned in Stale, ready for MergeDelta(). */
+static bool CheckDelta(string CacheFile, FileIterator Start,
+		       FileIterator End, vector<pkgIndexFile *> &Stale)
+{
+   if (CacheFile.empty() == true || FileExists(CacheFile) == false)
+      return false;
+   if (ReInstallOpt.FindB(false) == true)
+      return false;
+
+   FileFd CacheF(CacheFile,FileFd::ReadOnly);
+   SPtr<MMap> Map = new MMap(CacheF,MMap::Public | MMap::ReadOnly);
+   pkgCache Cache(Map);
+   if (_error->PendingError() == true || Map->Size() == 0)
+   {
+      _error->Discard();
+      return false;
+   }
+   if (_system->OptionsHash() != Cache.HeaderP->OptionsHash)
+      return false;
+
+   // Every file but the stale ones must match as in CheckValidity
+   vector<pkgIndexFile *> Candidates;
+   unsigned long Found = 0;
+   for (; Start != End; Start++)
+   {
+      if ((*Start)->HasPackages() == false || (*Start)->Exists() == false)
+	 continue;
+      pkgCache::PkgFileIterator File = (*Start)->FindInCache(Cache);
+      if (File.end() == true)
+	 Candidates.push_back(*Start);
+      else
+	 Found++;
+   }
+   if (Candidates.empty() == true ||
+       Found + Candidates.size() != Cache.HeaderP->PackageFileCount)
+      return false;
+
+   for (vector<pkgIndexFile *>::iterator I = Candidates.begin();
+	I != Candidates.end(); I++)
+      if ((*I)->CanMergeDelta(Cache) == false)
+	 return false;
+
+   if (_error->PendingError() == true)
+   {
+      _error->Discard();
+      return false;
+   }
+   
+   Stale = Candidates;
+   return true;
+}
+									/*}}}*/
+// CountFileDeps - Count the file dependency targets in the cache	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+static unsigned long CountFileDeps(pkgCache &Cache)
+{
+   unsigned long Count = 0;
+   for (pkgCache::PkgIterator Pkg = Cache.PkgBegin(); Pkg.end() == false; Pkg++)
+      if (Pkg.Name()[0] == '/')
+	 Count++;
+   return Count;
+}
+									/*}}}*/
 // ComputeSize - Compute the total size of a bunch of files		/*{{{*/
 // ---------------------------------------------------------------------
 /* Size is kind of an abstract notion that is only used for the progress
@@ -762,6 +928,7 @@ static bool CollectFileProvides(pkgCacheGenerator &Gen,
 bool pkgMakeStatusCache(pkgSourceList &List,OpProgress &Progress,
 			MMap **OutMap,bool AllowMem)
 {
+   ProfileTimer Timer("pkgMakeStatusCache");
    unsigned long MapSize = _config->FindI("APT::Cache-Limit",256*1024*1024);
    
    vector<pkgIndexFile *> Files(List.begin(),List.end());
@@ -801,6 +968,18 @@ bool pkgMakeStatusCache(pkgSourceList &List,OpProgress &Progress,
        return false;
    }
 #endif
+   /* If only status files went stale and they can tell what changed,
+      the old cache is updated instead. It has to be opened before it
+      is unlinked below. */
+   vector<pkgIndexFile *> Stale;
+   SPtr<FileFd> OldCacheF;
+   if (CheckDelta(CacheFile,Files.begin(),Files.end(),Stale) == true)
+   {
+      OldCacheF = new FileFd(CacheFile,FileFd::ReadOnly);
+      if (_error->PendingError() == true)
+	 return false;
+   }
+
    /* At this point we know we need to reconstruct the package cache,
       begin. */
    SPtr<FileFd> CacheF;
@@ -823,8 +1002,42 @@ bool pkgMakeStatusCache(pkgSourceList &List,OpProgress &Progress,
    // Lets try the source cache.
    unsigned long CurrentSize = 0;
    unsigned long TotalSize = 0;
-   if (CheckValidity(SrcCacheFile,Files.begin(),
-		     Files.begin()+EndOfSource) == true)
+   if (OldCacheF != 0)
+   {
+      // Preload the map with the old cache
+      if (OldCacheF->Read((unsigned char *)Map->Data() + Map->RawAllocate(OldCacheF->Size()),
+			  OldCacheF->Size()) == false)
+	 return false;
+      OldCacheF->Close();
+
+      pkgCacheGenerator Gen(Map.Get(),&Progress);
+      if (_error->PendingError() == true)
+	 return false;
+
+      TotalSize = ComputeSize(Stale.begin(),Stale.end());
+      unsigned long FileDeps = CountFileDeps(Gen.GetCache());
+      for (vector<pkgIndexFile *>::iterator I = Stale.begin();
+	   I != Stale.end(); I++)
+      {
+	 unsigned long Size = (*I)->Size();
+	 Progress.OverallProgress(CurrentSize,TotalSize,Size,_("Reading Package Lists"));
+	 CurrentSize += Size;
+	 if ((*I)->MergeDelta(Gen,Progress) == false)
+	    return false;
+      }
+
+      // New file dependencies may be provided by any package
+      if (CountFileDeps(Gen.GetCache()) != FileDeps)
+      {
+	 Gen.GetCache().HeaderP->HasFileDeps = true;
+	 TotalSize = CurrentSize + ComputeSize(Files.begin(),Files.end());
+	 if (CollectFileProvides(Gen,Progress,CurrentSize,TotalSize,
+				 Files.begin(),Files.end()) == false)
+	    return false;
+      }
+   }
+   else if (CheckValidity(SrcCacheFile,Files.begin(),
+			  Files.begin()+EndOfSource) == true)
    {
       // Preload the map with the source cache
       FileFd SCacheF(SrcCacheFile,FileFd::ReadOnly);
@@ -975,6 +1188,7 @@ bool pkgMakeStatusCache(pkgSourceList &List,OpProgress &Progress,
 /* */
 bool pkgMakeOnlyStatusCache(OpProgress &Progress,DynamicMMap **OutMap)
 {
+   ProfileTimer Timer("pkgMakeOnlyStatusCache");
    unsigned long MapSize = _config->FindI("APT::Cache-Limit",256*1024*1024);
    vector<pkgIndexFile *> Files;
    unsigned long EndOfSource = Files.size();
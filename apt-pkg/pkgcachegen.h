@@ -21,6 +21,8 @@
 
 #include <apt-pkg/pkgcache.h>
 
+#include <vector>
+
 class pkgSourceList;
 class OpProgress;
 class MMap;
@@ -64,6 +66,8 @@ class pkgCacheGenerator
    void DropProgress() {Progress = 0;}
    bool SelectFile(const string & File, const string & Site,
 		   pkgIndexFile const &Index, unsigned long Flags = 0);
+   bool SelectFile(pkgCache::PkgFileIterator File,pkgIndexFile const &Index);
+   bool DropFileVers(std::vector<unsigned long> const &Offsets);
    bool MergeList(ListParser &List,pkgCache::VerIterator *Ver = 0);
    inline pkgCache &GetCache() {return Cache;}
    inline pkgCache::PkgFileIterator GetCurFile() 
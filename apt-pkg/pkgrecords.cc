@@ -13,7 +13,10 @@
 #include <apt-pkg/indexfile.h>
 #include <apt-pkg/error.h>
 #include <apt-pkg/configuration.h>
-    
+#include <apt-pkg/strutl.h>
+
+#include <stdio.h>
+
 #include <apti18n.h>   
 									/*}}}*/
 using namespace std;
@@ -21,11 +24,13 @@ using namespace std;
 // Records::pkgRecords - Constructor					/*{{{*/
 // ---------------------------------------------------------------------
 /* This will create the necessary structures to access the status files */
-pkgRecords::pkgRecords(pkgCache &Cache) : Cache(Cache), 
-  Files(Cache.HeaderP->PackageFileCount)
+pkgRecords::pkgRecords(pkgCache &Cache,bool Lazy) : Cache(Cache), 
+  Files(Cache.HeaderP->PackageFileCount,0)
 {
 //   Files = new Parser *[Cache.HeaderP->PackageFileCount];
 //   memset(Files,0,sizeof(*Files)*Cache.HeaderP->PackageFileCount);
+   if (Lazy == true)
+      return;
    
    for (pkgCache::PkgFileIterator I = Cache.FileBegin(); 
 	I.end() == false; I++)
@@ -65,3 +70,111 @@ pkgRecords::Parser &pkgRecords::Lookup(pkgCache::VerFileIterator const &Ver)
    return *Files[Ver.File()->ID];
 }
 									/*}}}*/
+// Records::Find - Get a parser for the package version file if possible	/*{{{*/
+// ---------------------------------------------------------------------
+/* Unlike Lookup this opens the file when no parser exists for it yet,
+   and returns 0 when that or the jump to the record fails. Separate
+   lazy pkgRecords let several threads read records at the same time. */
+pkgRecords::Parser *pkgRecords::Find(pkgCache::VerFileIterator const &Ver)
+{
+   pkgCache::PkgFileIterator File = Ver.File();
+   Parser *&P = Files[File->ID];
+   if (P == 0)
+   {
+      const pkgIndexFile::Type *Type = pkgIndexFile::Type::GetType(File.IndexType());
+      if (Type == 0)
+      {
+	 _error->Error(_("Index file type '%s' is not supported"),File.IndexType());
+	 return 0;
+      }
+      P = Type->CreatePkgParser(File);
+      if (P == 0)
+	 return 0;
+   }
+   if (P->Jump(Ver) == false)
+      return 0;
+   return P;
+}
+									/*}}}*/
+// Parser::Field - Return a single field of the record			/*{{{*/
+// ---------------------------------------------------------------------
+/* Only the accessor of the field asked for is called, so this is much
+   cheaper than GetRec() when just a few fields are wanted. The tags are
+   the ones GetRec() uses, unknown ones give an empty string. */
+string pkgRecords::Parser::Field(string const &Tag)
+{
+   char S[32];
+   if (stringcasecmp(Tag,"Package") == 0)
+      return Name();
+   if (stringcasecmp(Tag,"Section") == 0)
+      return Section();
+   if (stringcasecmp(Tag,"Installed Size") == 0)
+   {
+      snprintf(S,sizeof(S),"%lu",InstalledSize());
+      return S;
+   }
+   if (stringcasecmp(Tag,"Packager") == 0 ||
+       stringcasecmp(Tag,"Maintainer") == 0)
+      return Maintainer();
+   if (stringcasecmp(Tag,"Version") == 0)
+      return Version();
+   if (stringcasecmp(Tag,"Architecture") == 0)
+      return Arch();
+   if (stringcasecmp(Tag,"Size") == 0)
+   {
+      snprintf(S,sizeof(S),"%lu",Size());
+      return S;
+   }
+   if (stringcasecmp(Tag,"Hash") == 0)
+      return Hash();
+   if (stringcasecmp(Tag,"Filename") == 0)
+      return FileName();
+   if (stringcasecmp(Tag,"Summary") == 0)
+      return ShortDesc();
+   if (stringcasecmp(Tag,"Description") == 0)
+      return LongDesc();
+   if (stringcasecmp(Tag,"Source") == 0)
+      return SourcePkg();
+
+   unsigned int Type;
+   if (stringcasecmp(Tag,"Pre-Depends") == 0)
+      Type = pkgCache::Dep::PreDepends;
+   else if (stringcasecmp(Tag,"Depends") == 0)
+      Type = pkgCache::Dep::Depends;
+   else if (stringcasecmp(Tag,"Conflicts") == 0)
+      Type = pkgCache::Dep::Conflicts;
+   else if (stringcasecmp(Tag,"Provides") == 0)
+      Type = pkgCache::Dep::Provides;
+   else if (stringcasecmp(Tag,"Obsoletes") == 0)
+      Type = pkgCache::Dep::Obsoletes;
+   else
+      return string();
+
+   vector<pkgRecordDep> Deps;
+   if (Depends(Type == pkgCache::Dep::PreDepends ? pkgCache::Dep::Depends : Type,
+	       Deps) == false)
+      return string();
+   return DepList(Deps,Type);
+}
+									/*}}}*/
+// Parser::DepList - Render relations of one type as a record would	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+string pkgRecords::Parser::DepList(vector<pkgRecordDep> const &Deps,
+				   unsigned int Type)
+{
+   string List;
+   for (vector<pkgRecordDep>::const_iterator I = Deps.begin();
+	I != Deps.end(); I++)
+   {
+      if (I->Type != Type)
+	 continue;
+      if (List.empty() == false)
+	 List += ", ";
+      List += I->Name;
+      if (I->Version.empty() == false)
+	 List += string(" ") + pkgCache::CompType(I->Op) + " " + I->Version;
+   }
+   return List;
+}
+									/*}}}*/
@@ -29,6 +29,15 @@ struct ChangeLogEntry
    string Text;
 };
 
+// A relation of the package as its record states it
+struct pkgRecordDep
+{
+   string Name;
+   string Version;
+   unsigned int Op;
+   unsigned int Type;
+};
+
 class pkgRecords
 {
    public:
@@ -43,9 +52,10 @@ class pkgRecords
 
    // Lookup function
    Parser &Lookup(pkgCache::VerFileIterator const &Ver);
+   Parser *Find(pkgCache::VerFileIterator const &Ver);
 
-   // Construct destruct
-   pkgRecords(pkgCache &Cache);
+   // Construct destruct, Lazy only opens the files Find() asks for
+   pkgRecords(pkgCache &Cache,bool Lazy = false);
    ~pkgRecords();
 };
 
@@ -70,6 +80,20 @@ class pkgRecords::Parser
    virtual string LongDesc() {return string();}
    virtual string Name() {return string();}
 
+   // Typed access to the rest of the record, each field is only taken
+   // from the index when asked for. Depends() returns the relations of
+   // one type, where Depends also brings the PreDepends ones.
+   virtual string Section() {return string();}
+   virtual string Version() {return string();}
+   virtual string Arch() {return string();}
+   virtual unsigned long Size() {return 0;}
+   virtual unsigned long InstalledSize() {return 0;}
+   virtual bool Depends(unsigned int Type,std::vector<pkgRecordDep> &Deps) {return false;}
+
+   // A single field by the tag GetRec() shows it under
+   string Field(string const &Tag);
+   static string DepList(std::vector<pkgRecordDep> const &Deps,unsigned int Type);
+
    // These are not supported by all repository types and can fail
    virtual bool ChangeLog(std::vector<ChangeLogEntry *> &ChangeLogs) { return false;}
    virtual bool FileList(std::vector<string> &Files) { return false;}
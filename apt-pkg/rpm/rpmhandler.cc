@@ -19,14 +19,19 @@
 #include <signal.h>
 #include <assert.h>
 #include <libgen.h>
+#include <ctype.h>
 #include <cstring>
 #include <sstream>
 #include <algorithm>
+#include <set>
+#include <map>
+#include <iostream>
 
 #include <apt-pkg/error.h>
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/md5.h>
 #include <apt-pkg/crc-16.h>
+#include <apt-pkg/mmap.h>
 
 #include "rpmhandler.h"
 #include "rpmpackagedata.h"
@@ -51,6 +56,10 @@
 #include <rpm/rpmds.h>
 #include <rpm/rpmsq.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 using namespace std;
 
 // An attempt to deal with false zero epochs from repomd. With older rpm's we
@@ -62,6 +71,53 @@ bool HideZeroEpoch;
 
 static rpmds rpmlibProv = NULL;
 
+// Answers of rpmlib for the rpmlib() requirements seen so far. There are
+// only a handful of distinct ones, but every package repeats them.
+static struct RpmlibMemoTable
+{
+   map<string,bool> Answers;
+   unsigned long Hits;
+   unsigned long Misses;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t Lock;
+
+   // Held across fork() so no child starts with it taken
+   static void Prepare();
+   static void Release();
+#endif
+
+   RpmlibMemoTable() : Hits(0), Misses(0)
+   {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_init(&Lock, NULL);
+      pthread_atfork(Prepare, Release, Release);
+#endif
+   }
+   ~RpmlibMemoTable()
+   {
+      if (_config->FindB("Debug::RPMHandler", false) == true &&
+	  Hits + Misses > 0)
+	 clog << "rpmlib() lookups: " << Hits + Misses << ", "
+	      << Answers.size() << " distinct, " << Hits << " hits ("
+	      << Hits * 100 / (Hits + Misses) << "%)" << endl;
+#ifdef HAVE_PTHREAD
+      pthread_mutex_destroy(&Lock);
+#endif
+   }
+} RpmlibMemo;
+
+#ifdef HAVE_PTHREAD
+void RpmlibMemoTable::Prepare()
+{
+   pthread_mutex_lock(&RpmlibMemo.Lock);
+}
+
+void RpmlibMemoTable::Release()
+{
+   pthread_mutex_unlock(&RpmlibMemo.Lock);
+}
+#endif
+
 string RPMHandler::EVR() const
 {
    string e = Epoch();
@@ -114,13 +170,34 @@ bool RPMHandler::HasFile(const char *File) const
 bool RPMHandler::InternalDep(const char *name, const char *ver, raptDepFlags flag)  const
 {
    if (strncmp(name, "rpmlib(", strlen("rpmlib(")) == 0) {
-     if (rpmlibProv == NULL)
-         rpmdsRpmlib(&rpmlibProv, NULL);
-
-     rpmds ds = rpmdsSingle(RPMTAG_PROVIDENAME,
-			    name, ver?ver:NULL, flag);
-     int res = rpmdsSearch(rpmlibProv, ds) >= 0;
-     rpmdsFree(ds);
+     string Key = string(name) + '\0' + (ver?ver:"") + '\0';
+     Key += (char)(flag & 0xff);
+     Key += (char)((flag >> 8) & 0xff);
+     Key += (char)((flag >> 16) & 0xff);
+     Key += (char)((flag >> 24) & 0xff);
+
+#ifdef HAVE_PTHREAD
+     pthread_mutex_lock(&RpmlibMemo.Lock);
+#endif
+     bool res;
+     map<string,bool>::const_iterator I = RpmlibMemo.Answers.find(Key);
+     if (I != RpmlibMemo.Answers.end()) {
+	res = I->second;
+	RpmlibMemo.Hits++;
+     } else {
+	if (rpmlibProv == NULL)
+	    rpmdsRpmlib(&rpmlibProv, NULL);
+
+	rpmds ds = rpmdsSingle(RPMTAG_PROVIDENAME,
+			       name, ver?ver:NULL, flag);
+	res = rpmdsSearch(rpmlibProv, ds) >= 0;
+	rpmdsFree(ds);
+	RpmlibMemo.Answers[Key] = res;
+	RpmlibMemo.Misses++;
+     }
+#ifdef HAVE_PTHREAD
+     pthread_mutex_unlock(&RpmlibMemo.Lock);
+#endif
      if (res) 
 	 return true;
    }
@@ -355,6 +432,102 @@ string RPMFileHandler::HashType() const
    return "MD5-Hash";
 }
 
+RPMMapFileHandler::RPMMapFileHandler(string File)
+   : RPMFileHandler(File), Map(0), Next(0)
+{
+   if (FD == NULL || iSize == 0 ||
+       _config->FindB("RPM::Map-PkgLists", true) == false)
+      return;
+
+   // Private and writable, so rpm can't fault on a header it touches
+   bool Pending = _error->PendingError();
+   FileFd Fd(Fileno(FD), false);
+   Map = new MMap(Fd, 0);
+   if (Map->Data() == 0) {
+      if (Pending == false)
+	 _error->Discard();
+      delete Map;
+      Map = 0;
+   }
+}
+
+RPMMapFileHandler::~RPMMapFileHandler()
+{
+   // The header may point into the map
+   if (HeaderP != NULL)
+      headerFree(HeaderP);
+   HeaderP = NULL;
+   delete Map;
+}
+
+static inline raptInt raptGetBE32(const unsigned char *P)
+{
+   return ((raptInt)P[0] << 24) | ((raptInt)P[1] << 16) |
+	  ((raptInt)P[2] << 8) | (raptInt)P[3];
+}
+
+bool RPMMapFileHandler::Skip()
+{
+   if (Map == 0)
+      return RPMFileHandler::Skip();
+
+   if (HeaderP != NULL)
+      headerFree(HeaderP);
+   HeaderP = NULL;
+   iOffset = Next;
+
+   // Header magic, reserved word, index and data counts
+   static const unsigned char Magic[] = {0x8e, 0xad, 0xe8, 0x01};
+   const unsigned char *Base = (const unsigned char *)Map->Data();
+   off_t Size = Map->Size();
+   if (iOffset + 16 > Size)
+      return false;
+   const unsigned char *H = Base + iOffset;
+   if (memcmp(H, Magic, sizeof(Magic)) != 0)
+      return false;
+   raptInt il = raptGetBE32(H + 8);
+   raptInt dl = raptGetBE32(H + 12);
+   if (il > 0xffff || dl > 0x0fffffff)
+      return false;
+   off_t Len = 16 + (off_t)il * 16 + dl;
+   if (iOffset + Len > Size)
+      return false;
+
+   // The blob starts at the index count. rpm before 4.9 loads it in
+   // place unless it is misaligned for its 32 bit reads; later versions
+   // take ownership of blobs not imported as copies.
+   void *Blob = (void *)(H + 8);
+#if RPM_VERSION >= 0x040900
+   HeaderP = headerImport(Blob, Len - 8, HEADERIMPORT_COPY);
+#else
+   if (((unsigned long)Blob & 3) != 0)
+      HeaderP = headerCopyLoad(Blob);
+   else
+      HeaderP = headerLoad(Blob);
+#endif
+   if (HeaderP == NULL)
+      return false;
+   Next = iOffset + Len;
+   return true;
+}
+
+bool RPMMapFileHandler::Jump(off_t Offset)
+{
+   if (Map == 0)
+      return RPMFileHandler::Jump(Offset);
+   Next = Offset;
+   return Skip();
+}
+
+void RPMMapFileHandler::Rewind()
+{
+   if (Map == 0) {
+      RPMFileHandler::Rewind();
+      return;
+   }
+   iOffset = Next = 0;
+}
+
 bool RPMSingleFileHandler::Skip()
 {
    if (FD == NULL)
@@ -546,7 +719,8 @@ string RPMDirHandler::HashType() const
 }
 
 RPMDBHandler::RPMDBHandler(bool WriteLock)
-   : Handler(0), WriteLock(WriteLock)
+   : Handler(0), WriteLock(WriteLock), DbFileSize(0), Counted(false),
+     Recording(true), MapValid(false), DeltaPos(0), InDelta(false)
 {
    RpmIter = NULL;
    string Dir = _config->Find("RPM::RootDir", "/");
@@ -561,8 +735,11 @@ RPMDBHandler::RPMDBHandler(bool WriteLock)
    // change any information in the database directly, we will
    // restore the mtime and save our cache.
    struct stat St;
-   stat(DataPath(false).c_str(), &St);
-   DbFileMtime = St.st_mtime;
+   if (stat(DataPath(false).c_str(), &St) == 0) {
+      DbFileMtime = St.st_mtime;
+      DbFileSize = St.st_size;
+   } else
+      DbFileMtime = 0;
 
    Handler = rpmtsCreate();
    rpmtsSetVSFlags(Handler, (rpmVSFlags_e)-1);
@@ -573,17 +750,12 @@ RPMDBHandler::RPMDBHandler(bool WriteLock)
       _error->Error(_("could not create RPM database iterator"));
       return;
    }
-   // iSize = rpmdbGetIteratorCount(RpmIter);
-   // This doesn't seem to work right now. Code in rpm (4.0.4, at least)
-   // returns a 0 from rpmdbGetIteratorCount() if raptInitIterator() is
-   // called with RPMDBI_PACKAGES or with keyp == NULL. The algorithm
-   // below will be used until there's support for it.
+   // The package count is only needed for progress reporting, so it is
+   // computed on demand by Size() instead of walking the whole database
+   // here. If the offset map saved by an earlier run still matches the
+   // database, Skip() doesn't need to record it again.
    iSize = 0;
-   rpmdbMatchIterator countIt;
-   countIt = raptInitIterator(Handler, RPMDBI_PACKAGES, NULL, 0);
-   while (rpmdbNextIterator(countIt) != NULL)
-      iSize++;
-   rpmdbFreeIterator(countIt);
+   MapValid = LoadMap(false);
 
    // Restore just after opening the database, and just after closing.
    if (WriteLock) {
@@ -638,14 +810,307 @@ string RPMDBHandler::DataPath(bool DirectoryOnly)
        return DBPath+"/"+File;
 }
 
+string RPMDBHandler::MapPath()
+{
+   return _config->FindFile("Dir::Cache::rpmdbmap");
+}
+
+// Size - Return the number of installed headers
+// iSize = rpmdbGetIteratorCount(RpmIter) doesn't work, as rpm (4.0.4, at
+// least) returns 0 when the iterator is created with RPMDBI_PACKAGES or
+// with keyp == NULL. Instead the offset map is used: a map matching the
+// database gives the exact count, an outdated one is good enough as an
+// estimate for the progress meter, and only without any map the database
+// is walked, recording the map on the way so that the next run can skip it.
+unsigned RPMDBHandler::Size()
+{
+   if (Counted == true)
+      return iSize;
+   Counted = true;
+
+   if (MapValid == true || LoadMap(true) == true)
+      return iSize;
+
+   if (ScanDB(Entries) == false)
+      return iSize;
+   iSize = Entries.size();
+   MapValid = true;
+   SaveMap();
+   return iSize;
+}
+
+// Entry - Describe the current header for the offset map
+RPMDBHandler::DBEntry RPMDBHandler::Entry(raptDbOffset Offset) const
+{
+   DBEntry E;
+   E.Offset = Offset;
+   E.Name = Name();
+   E.EVR = EVR();
+   E.Arch = Arch();
+   E.SHA1 = GetSTag(RPMTAG_SHA1HEADER);
+   return E;
+}
+
+// ScanDB - Walk the whole database on an iterator of its own
+bool RPMDBHandler::ScanDB(vector<DBEntry> &List)
+{
+   rpmdbMatchIterator ScanIt;
+   ScanIt = raptInitIterator(Handler, RPMDBI_PACKAGES, NULL, 0);
+   if (ScanIt == NULL)
+      return false;
+   Header SavedP = HeaderP;
+   List.clear();
+   while ((HeaderP = rpmdbNextIterator(ScanIt)) != NULL)
+      List.push_back(Entry(rpmdbGetIteratorOffset(ScanIt)));
+   rpmdbFreeIterator(ScanIt);
+   HeaderP = SavedP;
+   return true;
+}
+
+// ReadMap - Read the offset map of an earlier run
+// The database mtime and size the map was recorded with are returned
+// along with its count; the entries themselves only if List is given.
+bool RPMDBHandler::ReadMap(time_t &Mtime, off_t &FSize, unsigned long &Count,
+			   vector<DBEntry> *List)
+{
+   string File = MapPath();
+   if (File.empty() == true)
+      return false;
+
+   FILE *F = fopen(File.c_str(), "r");
+   if (F == NULL)
+      return false;
+
+   char Line[1024];
+   unsigned long M;
+   unsigned long long S;
+   if (fgets(Line, sizeof(Line), F) == NULL ||
+       sscanf(Line, "rpmdbmap 2 %lu %llu %lu", &M, &S, &Count) != 3) {
+      fclose(F);
+      return false;
+   }
+   Mtime = M;
+   FSize = S;
+   if (List == NULL) {
+      fclose(F);
+      return true;
+   }
+
+   List->clear();
+   List->reserve(Count);
+   while (fgets(Line, sizeof(Line), F) != NULL) {
+      char N[sizeof(Line)], V[sizeof(Line)], A[sizeof(Line)], H[sizeof(Line)];
+      unsigned long Off;
+      if (sscanf(Line, "%lu %s %s %s %s", &Off, N, V, A, H) != 5)
+	 break;
+      DBEntry E;
+      E.Offset = Off;
+      E.Name = N;
+      E.EVR = V;
+      if (strcmp(A, "-") != 0)
+	 E.Arch = A;
+      if (strcmp(H, "-") != 0)
+	 E.SHA1 = H;
+      List->push_back(E);
+   }
+   fclose(F);
+   return List->size() == Count;
+}
+
+// LoadMap - Load the offset map if it describes the database
+// The map is only taken as is when the mtime and size of the Packages
+// file match the ones it was recorded with. With Estimate set an
+// outdated map is still used for its package count.
+bool RPMDBHandler::LoadMap(bool Estimate)
+{
+   if (DbFileMtime == 0)
+      return false;
+
+   time_t Mtime;
+   off_t FSize;
+   unsigned long Count;
+   if (ReadMap(Mtime, FSize, Count, NULL) == false)
+      return false;
+
+   if (Mtime != DbFileMtime || FSize != DbFileSize) {
+      if (Estimate == false)
+	 return false;
+      iSize = Count;
+      return true;
+   }
+
+   if (ReadMap(Mtime, FSize, Count, &Entries) == false) {
+      Entries.clear();
+      return false;
+   }
+   iSize = Count;
+   Counted = true;
+   return true;
+}
+
+// SaveMap - Store the offset map for the next run
+// Failing to write it (eg. when not running as root) is not an error,
+// the next run will just have to record it again.
+bool RPMDBHandler::SaveMap()
+{
+   string File = MapPath();
+   if (File.empty() == true || DbFileMtime == 0)
+      return false;
+
+   string TmpFile = File + ".new";
+   FILE *F = fopen(TmpFile.c_str(), "w");
+   if (F == NULL)
+      return false;
+
+   fprintf(F, "rpmdbmap 2 %lu %llu %lu\n", (unsigned long)DbFileMtime,
+	   (unsigned long long)DbFileSize, (unsigned long)Entries.size());
+   for (vector<DBEntry>::const_iterator I = Entries.begin();
+	I != Entries.end(); I++)
+      fprintf(F, "%lu %s %s %s %s\n", (unsigned long)I->Offset,
+	      I->Name.c_str(), I->EVR.c_str(),
+	      I->Arch.empty() ? "-" : I->Arch.c_str(),
+	      I->SHA1.empty() ? "-" : I->SHA1.c_str());
+
+   if (ferror(F) != 0 || fclose(F) != 0 ||
+       rename(TmpFile.c_str(), File.c_str()) != 0) {
+      unlink(TmpFile.c_str());
+      return false;
+   }
+   return true;
+}
+
+static bool EntryOffsetCompare(const RPMDBHandler::DBEntry &A,
+			       const RPMDBHandler::DBEntry &B)
+{
+   return A.Offset < B.Offset;
+}
+
+// PrepareDelta - Find the headers added and gone since the cache was built
+// Mtime and FSize are the ones of the database the cache being updated
+// was built from, and the map recorded back then must match them. An
+// upgrade is a header gone and one added, possibly at the same instance.
+// A new header sharing its name with one still installed from before, or
+// with another new one, would have to become a duplicated package and
+// needs a full merge.
+bool RPMDBHandler::PrepareDelta(time_t Mtime, off_t FSize)
+{
+   InDelta = false;
+   Delta.clear();
+   Gone.clear();
+   if (DbFileMtime == 0 || MapValid == true)
+      return false;
+
+   time_t OldMtime;
+   off_t OldSize;
+   unsigned long Count;
+   vector<DBEntry> Old;
+   if (ReadMap(OldMtime, OldSize, Count, &Old) == false ||
+       OldMtime != Mtime || OldSize != FSize)
+      return false;
+
+   vector<DBEntry> Current;
+   if (ScanDB(Current) == false)
+      return false;
+
+   sort(Old.begin(), Old.end(), EntryOffsetCompare);
+   sort(Current.begin(), Current.end(), EntryOffsetCompare);
+
+   // Names still installed from before
+   std::set<string> Names;
+   vector<DBEntry>::const_iterator O = Old.begin();
+   vector<DBEntry>::const_iterator C = Current.begin();
+   while (O != Old.end() || C != Current.end()) {
+      if (C == Current.end() ||
+	  (O != Old.end() && O->Offset < C->Offset)) {
+	 Gone.push_back(O->Offset);
+	 O++;
+	 continue;
+      }
+      if (O == Old.end() || C->Offset < O->Offset) {
+	 Delta.push_back(C->Offset);
+	 C++;
+	 continue;
+      }
+      // rpm may reuse the instance of a removed header
+      if (C->SHA1 != O->SHA1 || C->Name != O->Name ||
+	  C->EVR != O->EVR || C->Arch != O->Arch) {
+	 Gone.push_back(O->Offset);
+	 Delta.push_back(C->Offset);
+      } else
+	 Names.insert(O->Name);
+      O++;
+      C++;
+   }
+
+   for (C = Current.begin(); C != Current.end(); C++) {
+      if (binary_search(Delta.begin(), Delta.end(), C->Offset) == false)
+	 continue;
+      if (Names.insert(C->Name).second == false) {
+	 Delta.clear();
+	 Gone.clear();
+	 return false;
+      }
+   }
+
+   Entries.swap(Current);
+   iSize = Entries.size();
+   Counted = true;
+   MapValid = true;
+   InDelta = true;
+   DeltaPos = 0;
+   return true;
+}
+
+// FinishDelta - Go back to walking the whole database
+void RPMDBHandler::FinishDelta()
+{
+   if (InDelta == false)
+      return;
+   InDelta = false;
+   Delta.clear();
+   Gone.clear();
+   SaveMap();
+   Rewind();
+}
+
 bool RPMDBHandler::Skip()
 {
    if (RpmIter == NULL)
        return false;
+   if (InDelta == true) {
+      // Only visit the headers added since the cache was built
+      while (DeltaPos < Delta.size()) {
+	 raptDbOffset Off = Delta[DeltaPos++];
+	 rpmdbFreeIterator(RpmIter);
+	 RpmIter = raptInitIterator(Handler, RPMDBI_PACKAGES,
+				    &Off, sizeof(Off));
+	 if (RpmIter == NULL)
+	    break;
+	 HeaderP = rpmdbNextIterator(RpmIter);
+	 if (HeaderP != NULL) {
+	    iOffset = Off;
+	    return true;
+	 }
+      }
+      HeaderP = NULL;
+      return false;
+   }
    HeaderP = rpmdbNextIterator(RpmIter);
    iOffset = rpmdbGetIteratorOffset(RpmIter);
-   if (HeaderP == NULL)
+   if (HeaderP == NULL) {
+      // A complete pass in database order gives both the exact count
+      // and a fresh offset map, so Size() won't have to walk it again.
+      if (Recording == true && MapValid == false) {
+	 iSize = Entries.size();
+	 Counted = true;
+	 MapValid = true;
+	 SaveMap();
+      }
+      Recording = false;
       return false;
+   }
+   if (Recording == true && MapValid == false)
+      Entries.push_back(Entry(iOffset));
    return true;
 }
 
@@ -656,6 +1121,7 @@ bool RPMDBHandler::Jump(off_t Offset)
    raptDbOffset rpmOffset = iOffset;
    if (RpmIter == NULL)
       return false;
+   Recording = false;
    rpmdbFreeIterator(RpmIter);
    if (iOffset == 0)
       RpmIter = raptInitIterator(Handler, RPMDBI_PACKAGES, NULL, 0);
@@ -672,12 +1138,56 @@ bool RPMDBHandler::JumpByName(string PkgName, bool Provides)
 {
    raptTag tag = (raptTag)(Provides ? RPMTAG_PROVIDES : RPMDBI_LABEL);
    if (RpmIter == NULL) return false;
+   Recording = false;
    rpmdbFreeIterator(RpmIter);
    RpmIter = raptInitIterator(Handler, tag, PkgName.c_str(), 0);
    HeaderP = rpmdbNextIterator(RpmIter);
    return (HeaderP != NULL);
 }
 
+// FindNames - Look many names up in the rpmdb at once
+// With rpm 4.9 and later a long list is matched against the keys of the
+// Name or Providename index in a single walk over them. Shorter lists,
+// and older rpm versions, take one lookup per name.
+bool RPMDBHandler::FindNames(rpmts TS, vector<string> const &Names,
+			     bool Provides,
+			     vector<pair<unsigned long,raptDbOffset> > &Matches)
+{
+   raptTag Tag = (raptTag)(Provides ? RPMTAG_PROVIDENAME : RPMTAG_NAME);
+#if RPM_VERSION >= 0x040900
+   rpmdbIndexIterator II = NULL;
+   if (Names.size() >= 32)
+      II = rpmdbIndexIteratorInit(rpmtsGetRdb(TS), (rpmDbiTag)Tag);
+   if (II != NULL) {
+      const void *Key;
+      size_t KeyLen;
+      while (rpmdbIndexIteratorNext(II, &Key, &KeyLen) == 0) {
+	 string Name((const char *)Key, KeyLen);
+	 vector<string>::const_iterator N;
+	 N = lower_bound(Names.begin(), Names.end(), Name);
+	 for (; N != Names.end() && *N == Name; N++) {
+	    unsigned int Count = rpmdbIndexIteratorNumPkgs(II);
+	    for (unsigned int I = 0; I < Count; I++)
+	       Matches.push_back(make_pair(N - Names.begin(),
+				 rpmdbIndexIteratorPkgOffset(II, I)));
+	 }
+      }
+      rpmdbIndexIteratorFree(II);
+      return true;
+   }
+#endif
+   for (unsigned long I = 0; I < Names.size(); I++) {
+      rpmdbMatchIterator MI;
+      MI = raptInitIterator(TS, Tag, Names[I].c_str(), 0);
+      if (MI == NULL)
+	 continue;
+      while (rpmdbNextIterator(MI) != NULL)
+	 Matches.push_back(make_pair(I, rpmdbGetIteratorOffset(MI)));
+      rpmdbFreeIterator(MI);
+   }
+   return true;
+}
+
 void RPMDBHandler::Rewind()
 {
    if (RpmIter == NULL)
@@ -685,6 +1195,11 @@ void RPMDBHandler::Rewind()
    rpmdbFreeIterator(RpmIter);   
    RpmIter = raptInitIterator(Handler, RPMDBI_PACKAGES, NULL, 0);
    iOffset = 0;
+   DeltaPos = 0;
+   // Start recording the offset map anew unless it is known good
+   Recording = true;
+   if (MapValid == false)
+      Entries.clear();
 }
 #endif
 
@@ -1054,7 +1569,7 @@ bool RPMRepomdHandler::ShortFileList(vector<string> &FileList) const
 bool RPMRepomdHandler::FileList(vector<string> &FileList) const
 {
    RPMRepomdFLHandler *FL = new RPMRepomdFLHandler(FilelistPath);
-   bool res = FL->Jump(iOffset);
+   bool res = FL->JumpByPkgId(Hash()) || FL->Jump(iOffset);
    res &= FL->FileList(FileList);
    delete FL;
    return res; 
@@ -1063,7 +1578,7 @@ bool RPMRepomdHandler::FileList(vector<string> &FileList) const
 bool RPMRepomdHandler::ChangeLog(vector<ChangeLogEntry* > &ChangeLogs) const
 {
    RPMRepomdOtherHandler *OL = new RPMRepomdOtherHandler(OtherPath);
-   bool res = OL->Jump(iOffset);
+   bool res = OL->JumpByPkgId(Hash()) || OL->Jump(iOffset);
    res &= OL->ChangeLog(ChangeLogs);
    delete OL;
    return res; 
@@ -1075,7 +1590,8 @@ RPMRepomdHandler::~RPMRepomdHandler()
 }
 
 RPMRepomdReaderHandler::RPMRepomdReaderHandler(string File) : RPMHandler(),
-   XmlFile(NULL), XmlPath(File), NodeP(NULL)
+   XmlFile(NULL), XmlPath(File), NodeP(NULL), IndexFd(NULL), Map(NULL),
+   End(0), TriedIndex(false), Indexed(false), Doc(NULL)
 {
    ID = File;
    iOffset = -1;
@@ -1114,6 +1630,12 @@ error:
 
 bool RPMRepomdReaderHandler::Jump(off_t Offset)
 {
+   // Anything but moving forward on the reader goes through the index
+   if (Indexed == true || Offset <= iOffset || Offset > iOffset + 1) {
+      if (LoadIndex() == true)
+	 return ParseAt(Offset);
+   }
+
    bool res = false;
    while (iOffset != Offset) {
       res = Skip();
@@ -1124,14 +1646,29 @@ bool RPMRepomdReaderHandler::Jump(off_t Offset)
    return res;
 }
 
+bool RPMRepomdReaderHandler::JumpByPkgId(string PkgId)
+{
+   if (LoadIndex() == false)
+      return false;
+   map<string,off_t>::const_iterator I = PkgIds.find(PkgId);
+   if (I == PkgIds.end())
+      return false;
+   return ParseAt(I->second);
+}
+
 void RPMRepomdReaderHandler::Rewind()
 {
-   // XXX Ignore rewinds when already at start, any other cases we can't
-   // handle at the moment. Other cases shouldn't be needed due to usage
-   // patterns but just in case...
-   if (iOffset != -1) {
-      _error->Error(_("Internal error: xmlReader cannot rewind"));
+   if (iOffset == -1)
+      return;
+   // The reader can't go back, but the index can start over
+   if (LoadIndex() == true) {
+      Indexed = true;
+      iOffset = -1;
+      return;
    }
+   // XXX Other cases shouldn't be needed due to usage patterns but just
+   // in case...
+   _error->Error(_("Internal error: xmlReader cannot rewind"));
 }
 
 bool RPMRepomdReaderHandler::Skip()
@@ -1139,6 +1676,8 @@ bool RPMRepomdReaderHandler::Skip()
    if (iOffset +1 >= iSize) {
       return false;
    }
+   if (Indexed == true)
+      return ParseAt(iOffset + 1);
    if (iOffset >= 0) {
       xmlTextReaderNext(XmlFile);
    }
@@ -1148,6 +1687,178 @@ bool RPMRepomdReaderHandler::Skip()
    return true;
 }
 
+// Parse a single package element out of the mapped file
+bool RPMRepomdReaderHandler::ParseAt(off_t Offset)
+{
+   if (Offset < 0 || Offset >= (off_t)Starts.size())
+      return false;
+
+   off_t Stop = (Offset + 1 < (off_t)Starts.size()) ? Starts[Offset+1] : End;
+   xmlDocPtr NewDoc = xmlReadMemory((char *)Map->Data() + Starts[Offset],
+				    Stop - Starts[Offset], XmlPath.c_str(),
+				    NULL, XML_PARSE_NONET|XML_PARSE_NOBLANKS);
+   if (NewDoc == NULL)
+      return _error->Error(_("Failed to parse package %lu of %s"),
+			   (unsigned long)Offset, XmlPath.c_str());
+
+   if (Doc != NULL)
+      xmlFreeDoc(Doc);
+   Doc = NewDoc;
+   NodeP = xmlDocGetRootElement(Doc);
+   iOffset = Offset;
+   Indexed = true;
+   return true;
+}
+
+// Find the package elements in the mapped file. Markup can't show up
+// unescaped in the text of filelists.xml and other.xml, so every
+// "<package" start tag is one, and its pkgid attribute comes first.
+bool RPMRepomdReaderHandler::ScanIndex()
+{
+   const char *Base = (const char *)Map->Data();
+   const char *Stop = Base + Map->Size();
+   Starts.clear();
+   PkgIds.clear();
+   End = 0;
+
+   for (const char *P = Base; P < Stop; P++) {
+      P = (const char *)memmem(P, Stop - P, "<package", 8);
+      if (P == NULL || P + 8 >= Stop)
+	 break;
+      if (isspace(P[8]) == 0 && P[8] != '>')
+	 continue;
+
+      const char *Tag = (const char *)memchr(P, '>', Stop - P);
+      if (Tag == NULL)
+	 break;
+      const char *Id = (const char *)memmem(P, Tag - P, "pkgid=\"", 7);
+      if (Id != NULL) {
+	 Id += 7;
+	 const char *IdEnd = (const char *)memchr(Id, '"', Tag - Id);
+	 if (IdEnd != NULL)
+	    PkgIds[string(Id, IdEnd - Id)] = Starts.size();
+      }
+      Starts.push_back(P - Base);
+      P = Tag;
+   }
+
+   // The last package ends where the root element is closed
+   for (const char *P = Stop - 2; Starts.empty() == false &&
+	P > Base + Starts.back(); P--) {
+      if (P[0] == '<' && P[1] == '/') {
+	 End = P - Base;
+	 break;
+      }
+   }
+   return End != 0 && (off_t)Starts.size() == iSize;
+}
+
+// Read the offset index left by an earlier run if it matches the file
+bool RPMRepomdReaderHandler::ReadIndex(time_t Mtime, off_t FSize)
+{
+   FILE *F = fopen((XmlPath + ".idx").c_str(), "r");
+   if (F == NULL)
+      return false;
+
+   char Line[1024];
+   unsigned long M, Count;
+   unsigned long long S, E;
+   if (fgets(Line, sizeof(Line), F) == NULL ||
+       sscanf(Line, "repomdidx 1 %lu %llu %lu %llu", &M, &S, &Count, &E) != 4 ||
+       (time_t)M != Mtime || (off_t)S != FSize || (off_t)Count != iSize ||
+       (off_t)E > FSize) {
+      fclose(F);
+      return false;
+   }
+
+   Starts.clear();
+   Starts.reserve(Count);
+   PkgIds.clear();
+   while (fgets(Line, sizeof(Line), F) != NULL) {
+      char Id[sizeof(Line)];
+      unsigned long long Off;
+      if (sscanf(Line, "%llu %s", &Off, Id) != 2 || (off_t)Off >= (off_t)E)
+	 break;
+      if (strcmp(Id, "-") != 0)
+	 PkgIds[Id] = Starts.size();
+      Starts.push_back(Off);
+   }
+   fclose(F);
+   End = E;
+   return Starts.size() == Count;
+}
+
+// Store the offset index, failing to do so (eg. when not running as
+// root) only means it is built again next time
+bool RPMRepomdReaderHandler::SaveIndex(time_t Mtime, off_t FSize)
+{
+   string File = XmlPath + ".idx";
+   string TmpFile = File + ".new";
+   FILE *F = fopen(TmpFile.c_str(), "w");
+   if (F == NULL)
+      return false;
+
+   // Write the pkgids back in file order
+   vector<const string *> Ids(Starts.size());
+   for (map<string,off_t>::const_iterator I = PkgIds.begin();
+	I != PkgIds.end(); I++)
+      Ids[I->second] = &I->first;
+
+   fprintf(F, "repomdidx 1 %lu %llu %lu %llu\n", (unsigned long)Mtime,
+	   (unsigned long long)FSize, (unsigned long)Starts.size(),
+	   (unsigned long long)End);
+   for (unsigned long I = 0; I < Starts.size(); I++)
+      fprintf(F, "%llu %s\n", (unsigned long long)Starts[I],
+	      Ids[I] == NULL ? "-" : Ids[I]->c_str());
+
+   if (ferror(F) != 0 || fclose(F) != 0 ||
+       rename(TmpFile.c_str(), File.c_str()) != 0) {
+      unlink(TmpFile.c_str());
+      return false;
+   }
+   return true;
+}
+
+// LoadIndex - Map the XML file and get the offsets of its packages
+// The index is only tried once per handler. Without a usable one the
+// handler keeps to the streaming reader, which is all a full pass needs.
+bool RPMRepomdReaderHandler::LoadIndex()
+{
+   if (TriedIndex == true)
+      return Map != NULL;
+   TriedIndex = true;
+
+   struct stat St;
+   if (_config->FindB("RPM::RepoMD-Index", true) == false ||
+       iSize <= 0 || stat(XmlPath.c_str(), &St) != 0 || St.st_size == 0)
+      return false;
+
+   bool Pending = _error->PendingError();
+   IndexFd = new FileFd(XmlPath, FileFd::ReadOnly);
+   if (IndexFd->IsOpen() == true)
+      Map = new MMap(*IndexFd, MMap::ReadOnly);
+   if (Map == NULL || Map->Data() == NULL) {
+      if (Pending == false)
+	 _error->Discard();
+      delete Map;
+      Map = NULL;
+      return false;
+   }
+
+   if (ReadIndex(St.st_mtime, St.st_size) == true)
+      return true;
+   if (ScanIndex() == true) {
+      SaveIndex(St.st_mtime, St.st_size);
+      return true;
+   }
+
+   delete Map;
+   Map = NULL;
+   Starts.clear();
+   PkgIds.clear();
+   return false;
+}
+
 string RPMRepomdReaderHandler::FindTag(const char *Tag) const
 {
    string str = "";
@@ -1177,6 +1888,10 @@ string RPMRepomdReaderHandler::FindVerTag(const char *Tag) const
 
 RPMRepomdReaderHandler::~RPMRepomdReaderHandler()
 {
+   if (Doc != NULL)
+      xmlFreeDoc(Doc);
+   delete Map;
+   delete IndexFd;
    xmlFreeTextReader(XmlFile);
 }
 
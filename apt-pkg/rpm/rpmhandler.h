@@ -29,6 +29,9 @@
 #include <dirent.h>
 
 #include <vector>
+#include <map>
+
+class MMap;
 
 // Our Extra RPM tags. These should not be accessed directly. Use
 // the methods in RPMHandler instead.
@@ -42,6 +45,7 @@
 
 using std::string;
 using std::vector;
+using std::map;
 
 struct Dependency
 {
@@ -75,7 +79,7 @@ class RPMHandler
    virtual void Rewind() = 0;
    inline unsigned Offset() const {return iOffset;}
    virtual bool OrderedOffset() const {return true;}
-   inline unsigned Size() {return iSize;}
+   virtual unsigned Size() {return iSize;}
    virtual bool IsDatabase() const {return false;};
 
    virtual string FileName() const = 0;
@@ -178,6 +182,26 @@ class RPMFileHandler : public RPMHdrHandler
    virtual ~RPMFileHandler();
 };
 
+// A pkglist mapped in memory as a whole. Headers are found from their
+// intro counts and imported from the map, so neither Skip() nor Jump()
+// need a system call. Falls back to reading when the map fails.
+class RPMMapFileHandler : public RPMFileHandler
+{
+   private:
+
+   MMap *Map;
+   off_t Next;
+
+   public:
+
+   virtual bool Skip();
+   virtual bool Jump(off_t Offset);
+   virtual void Rewind();
+
+   RPMMapFileHandler(string File);
+   virtual ~RPMMapFileHandler();
+};
+
 class RPMSingleFileHandler : public RPMFileHandler
 {   
    private:
@@ -203,6 +227,18 @@ class RPMSingleFileHandler : public RPMFileHandler
 
 class RPMDBHandler : public RPMHdrHandler
 {
+   public:
+
+   // One installed header as seen by the last full pass over the rpmdb
+   struct DBEntry
+   {
+      raptDbOffset Offset;
+      string Name;
+      string EVR;
+      string Arch;
+      string SHA1;
+   };
+
    private:
 
    rpmts Handler;
@@ -210,10 +246,34 @@ class RPMDBHandler : public RPMHdrHandler
    bool WriteLock;
 
    time_t DbFileMtime;
+   off_t DbFileSize;
+
+   // Offset map of the database, filled by a single pass over it and
+   // kept in Dir::Cache::rpmdbmap until the Packages file changes
+   vector<DBEntry> Entries;
+   bool Counted;
+   bool Recording;
+   bool MapValid;
+
+   // Headers added and gone since the status cache was built, see
+   // PrepareDelta()
+   vector<raptDbOffset> Delta;
+   vector<unsigned long> Gone;
+   unsigned int DeltaPos;
+   bool InDelta;
+
+   DBEntry Entry(raptDbOffset Offset) const;
+   bool ScanDB(vector<DBEntry> &List);
+   bool ReadMap(time_t &Mtime, off_t &FSize, unsigned long &Count,
+		vector<DBEntry> *List);
+   bool LoadMap(bool Estimate);
+   bool SaveMap();
 
    public:
 
    static string DataPath(bool DirectoryOnly=true);
+   static string MapPath();
+   virtual unsigned Size();
    virtual bool Skip();
    virtual bool Jump(off_t Offset);
    virtual void Rewind();
@@ -225,6 +285,23 @@ class RPMDBHandler : public RPMHdrHandler
    // used by rpmSystem::DistroVer()
    bool JumpByName(string PkgName, bool Provides=false);
 
+   // Instances of the headers named, or providing a name with Provides
+   // set, as pairs of the index into Names and the instance. Names must
+   // be sorted, a long list is matched in one pass over the rpmdb index.
+   static bool FindNames(rpmts TS, vector<string> const &Names,
+			 bool Provides,
+			 vector<std::pair<unsigned long,raptDbOffset> > &Matches);
+   bool FindNames(vector<string> const &Names, bool Provides,
+		  vector<std::pair<unsigned long,raptDbOffset> > &Matches)
+      {return FindNames(Handler, Names, Provides, Matches);}
+
+   // Restrict Skip() to the headers added since the database had the
+   // given mtime and size, used by rpmDatabaseIndex::MergeDelta().
+   // The instances of the headers gone since are in DeltaGone(), sorted.
+   bool PrepareDelta(time_t Mtime, off_t FSize);
+   vector<unsigned long> const &DeltaGone() const {return Gone;}
+   void FinishDelta();
+
    RPMDBHandler(bool WriteLock=false);
    virtual ~RPMDBHandler();
 };
@@ -320,6 +397,23 @@ class RPMRepomdReaderHandler : public RPMHandler
    string XmlPath;
    xmlNode *NodeP;
 
+   // Byte offsets of the package elements, kept in XmlPath.idx until
+   // the XML file changes. Once a package was parsed out of the map
+   // through them (Indexed) the reader is left behind for good.
+   FileFd *IndexFd;
+   MMap *Map;
+   vector<off_t> Starts;
+   off_t End;
+   map<string,off_t> PkgIds;
+   bool TriedIndex;
+   bool Indexed;
+   xmlDocPtr Doc;
+
+   bool ScanIndex();
+   bool ReadIndex(time_t Mtime, off_t FSize);
+   bool SaveIndex(time_t Mtime, off_t FSize);
+   bool ParseAt(off_t Offset);
+
    string FindTag(const char *Tag) const;
    string FindVerTag(const char *Tag) const;
 
@@ -328,6 +422,10 @@ class RPMRepomdReaderHandler : public RPMHandler
    virtual bool Jump(off_t Offset);
    virtual void Rewind();
 
+   // Load the offset index, building it when missing or outdated
+   bool LoadIndex();
+   bool JumpByPkgId(string PkgId);
+
    virtual string FileName() const {return XmlPath;}
    virtual string Directory() const {return "";}
    virtual off_t FileSize() const {return 0;}
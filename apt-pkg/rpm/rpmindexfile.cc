@@ -770,6 +770,18 @@ bool rpmRepomdIndex::Merge(pkgCacheGenerator &Gen,OpProgress &Prog) const
    
    delete Handler;
 
+   // Index the file lists and changelogs while they are fresh, so that
+   // the records of single packages can be found in them directly
+   if (HasDBExtension() == false)
+   {
+      string FLFile = IndexFile("filelists");
+      if (FileExists(FLFile) == true)
+	 RPMRepomdFLHandler(FLFile).LoadIndex();
+      string OtherFile = IndexFile("other");
+      if (FileExists(OtherFile) == true)
+	 RPMRepomdOtherHandler(OtherFile).LoadIndex();
+   }
+
    // Check the release file
    string RelFile = ReleasePath();
    if (FileExists(RelFile) == true)
@@ -878,6 +890,7 @@ RPMHandler *rpmDatabaseIndex::CreateHandler() const
 bool rpmDatabaseIndex::Merge(pkgCacheGenerator &Gen,OpProgress &Prog) const
 {
    RPMDBHandler *Handler = rpmSys.GetDBHandler();
+   Handler->FinishDelta();
    rpmListParser Parser(Handler);
    if (_error->PendingError() == true)
       return _error->Error(_("Problem opening RPM database"));
@@ -907,6 +920,7 @@ bool rpmDatabaseIndex::MergeFileProvides(pkgCacheGenerator &Gen,
 		   		  	 OpProgress &Prog) const
 {
    RPMDBHandler *Handler = rpmSys.GetDBHandler();
+   Handler->FinishDelta();
    rpmListParser Parser(Handler);
    if (_error->PendingError() == true)
       return _error->Error(_("Problem opening RPM database"));
@@ -938,6 +952,74 @@ pkgCache::PkgFileIterator rpmDatabaseIndex::FindInCache(pkgCache &Cache) const
    return File;
 }
 									/*}}}*/
+// DatabaseIndex::CanMergeDelta - Check if the database was only added to /*{{{*/
+// ---------------------------------------------------------------------
+/* The offset map of the database as it was when Cache was built is
+   compared with the database now. The handler is left prepared to merge
+   just the headers added since, see RPMDBHandler::PrepareDelta(). */
+bool rpmDatabaseIndex::CanMergeDelta(pkgCache &Cache) const
+{
+   if (_config->FindB("RPM::DB-Delta", true) == false)
+      return false;
+
+   RPMDBHandler *Handler = rpmSys.GetDBHandler();
+   pkgCache::PkgFileIterator File = Cache.FileBegin();
+   for (; File.end() == false; File++)
+   {
+      if (Handler->DataPath(false) != File.FileName())
+	 continue;
+      return Handler->PrepareDelta(File->mtime, File->Size);
+   }
+   return false;
+}
+									/*}}}*/
+// DatabaseIndex::MergeDelta - Merge the headers added to the database	/*{{{*/
+// ---------------------------------------------------------------------
+/* The records of the headers gone since are dropped from the entry the
+   database already has in the cache, then only the headers added since
+   are merged into it. */
+bool rpmDatabaseIndex::MergeDelta(pkgCacheGenerator &Gen,OpProgress &Prog) const
+{
+   RPMDBHandler *Handler = rpmSys.GetDBHandler();
+   pkgCache::PkgFileIterator CFile = Gen.GetCache().FileBegin();
+   for (; CFile.end() == false; CFile++)
+      if (Handler->DataPath(false) == CFile.FileName())
+	 break;
+
+   Prog.SubProgress(0,"RPM Database");
+   if (Gen.SelectFile(CFile,*this) == false)
+      return _error->Error(_("Problem with SelectFile RPM Database"));
+
+   // Store the IMS information
+   struct stat St;
+   if (stat(Handler->DataPath(false).c_str(),&St) != 0)
+      return _error->Errno("fstat",_("Failed to stat %s"), Handler->DataPath(false).c_str());
+   CFile->Size = St.st_size;
+   CFile->mtime = Handler->Mtime();
+
+   if (Gen.DropFileVers(Handler->DeltaGone()) == false)
+      return false;
+
+   {
+      rpmListParser Parser(Handler);
+      if (Gen.MergeList(Parser) == false)
+	 return _error->Error(_("Problem with MergeList %s"),
+			      Handler->DataPath(false).c_str());
+   }
+
+   // The new headers may provide files already depended on
+   if (Gen.GetCache().HeaderP->HasFileDeps == true)
+   {
+      rpmListParser Parser(Handler);
+      if (Gen.MergeFileProvides(Parser) == false)
+	 return _error->Error(_("Problem with MergeFileProvides %s"),
+			      Handler->DataPath(false).c_str());
+   }
+
+   Handler->FinishDelta();
+   return true;
+}
+									/*}}}*/
 
 // Source List types for rpm						/*{{{*/
 
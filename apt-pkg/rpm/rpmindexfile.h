@@ -66,6 +66,8 @@ class rpmDatabaseIndex : public rpmIndexFile
    virtual bool MergeFileProvides(pkgCacheGenerator &/*Gen*/,
 		   		  OpProgress &/*Prog*/) const;
    virtual pkgCache::PkgFileIterator FindInCache(pkgCache &Cache) const;
+   virtual bool CanMergeDelta(pkgCache &Cache) const;
+   virtual bool MergeDelta(pkgCacheGenerator &Gen,OpProgress &Prog) const;
 
    rpmDatabaseIndex();
 };
@@ -122,7 +124,7 @@ class rpmPkgListIndex : public rpmListIndex
    
    // Creates a RPMHandler suitable for usage with this object
    virtual RPMHandler *CreateHandler() const
-	   { return new RPMFileHandler(IndexPath()); }
+	   { return new RPMMapFileHandler(IndexPath()); }
 
    // Stuff for accessing files on remote items
    virtual string ArchiveInfo(pkgCache::VerIterator Ver) const;
@@ -157,7 +159,7 @@ class rpmSrcListIndex : public rpmListIndex
 
    // Creates a RPMHandler suitable for usage with this object
    virtual RPMHandler *CreateHandler() const
-	   { return new RPMFileHandler(IndexPath()); }
+	   { return new RPMMapFileHandler(IndexPath()); }
 
    // Stuff for accessing files on remote items
    virtual string SourceInfo(pkgSrcRecords::Parser const &Record,
@@ -25,6 +25,7 @@
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/crc-16.h>
 #include <apt-pkg/tagfile.h>
+#include <apt-pkg/profile.h>
 #include <apt-pkg/error.h>
 
 #include <apti18n.h>
@@ -382,6 +383,7 @@ bool rpmListParser::Step()
 {
    while (Handler->Skip() == true)
    {
+      Profile::Count(Profile::HeadersParsed);
       CurrentName = "";
 
 #ifdef WITH_VERSION_CACHING
@@ -17,6 +17,7 @@
 #include <apt-pkg/configuration.h>
 #include <apt-pkg/luaiface.h>
 #include <apt-pkg/depcache.h>
+#include <apt-pkg/profile.h>
 
 #include <apti18n.h>
 
@@ -30,11 +31,18 @@
 #include <stdio.h>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include <rpm/rpmlog.h>
 #include <rpm/rpmdb.h>
 
 #include "aptcallback.h"
+#include "raptheader.h"
+#include "rpmhandler.h"
 
 using namespace std;
 
@@ -224,11 +232,45 @@ bool pkgRPMPM::RunScriptsWithPkgs(const char *Cnf)
 									/*}}}*/
 
 
+// RPMPM::FindInstance - Find where an installed package is in the rpmdb	/*{{{*/
+// ---------------------------------------------------------------------
+/* The offset recorded for the version from the rpmdb status file is the
+   rpmdb instance of its header. */
+pkgRPMPM::DBInstance pkgRPMPM::FindInstance(PkgIterator Pkg)
+{
+   DBInstance Inst;
+   Inst.Offset = 0;
+   Inst.Dup = false;
+   Inst.Arch = Pkg.CurrentVer().Arch();
+
+   // Undo the munging of multilib and duplicated package names
+   Inst.Name = Pkg.Name();
+   string::size_type loc;
+   if ((loc = Inst.Name.rfind(".32bit")) != string::npos)
+      Inst.Name = Inst.Name.substr(0,loc);
+   else if ((loc = Inst.Name.rfind("#")) != string::npos)
+   {
+      Inst.Name = Inst.Name.substr(0,loc);
+      Inst.Dup = true;
+   }
+
+   for (VerFileIterator VF = Pkg.CurrentVer().FileList();
+	VF.end() == false; VF++)
+   {
+      if ((VF.File()->Flags & pkgCache::Flag::NotSource) == 0)
+	 continue;
+      Inst.Offset = VF->Offset;
+      break;
+   }
+   return Inst;
+}
+									/*}}}*/
 // RPMPM::Go - Run the sequence						/*{{{*/
 // ---------------------------------------------------------------------
 /* This globs the operations and calls rpm */
 bool pkgRPMPM::Go()
 {
+   ProfileTimer Timer("pkgRPMPM::Go");
    if (List.empty() == true)
       return true;
 
@@ -246,6 +288,7 @@ bool pkgRPMPM::Go()
    vector<pkgCache::Package*> pkgs_uninstall;
 
    vector<char*> unalloc;
+   Uninstall.clear();
    
    for (vector<Item>::iterator I = List.begin(); I != List.end(); I++)
    {
@@ -269,6 +312,7 @@ bool pkgRPMPM::Go()
 	 uninstall.push_back(strdup(RealName.c_str()));
 	 unalloc.push_back(strdup(RealName.c_str()));
 	 pkgs_uninstall.push_back(I->Pkg);
+	 Uninstall.push_back(FindInstance(I->Pkg));
 	 break;
 
        case Item::Configure:
@@ -661,55 +705,282 @@ pkgRPMLibPM::~pkgRPMLibPM()
 }
 									/*}}}*/
 
+// Work shared by the threads reading package headers
+struct rpmHeaderReader
+{
+   vector<const char*> &Files;
+   vector<rpmHeader> &Headers;
+   vector<int> Results;
+   vector<char> Opened;
+   rpmVSFlags VSFlags;
+   string RootDir;
+   unsigned long Next;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t Lock;
+#endif
+
+   rpmHeaderReader(vector<const char*> &Files,vector<rpmHeader> &Headers) :
+      Files(Files), Headers(Headers), Results(Files.size(),RPMRC_FAIL),
+      Opened(Files.size(),0), Next(0) {}
+};
+
+// Read headers until no file is left. This must not touch _error, the
+// results are reported by the caller in the order of the files.
+static void *rpmReadHeaders(void *Arg)
+{
+   rpmHeaderReader *Reader = (rpmHeaderReader *)Arg;
+   rpmts ts = rpmtsCreate();
+   rpmtsSetVSFlags(ts, Reader->VSFlags);
+   rpmtsSetRootDir(ts, Reader->RootDir.c_str());
+   while (1)
+   {
+#ifdef HAVE_PTHREAD
+      pthread_mutex_lock(&Reader->Lock);
+#endif
+      unsigned long I = Reader->Next++;
+#ifdef HAVE_PTHREAD
+      pthread_mutex_unlock(&Reader->Lock);
+#endif
+      if (I >= Reader->Files.size())
+	 break;
+
+      FD_t fd = Fopen(Reader->Files[I], "r.ufdio");
+      if (fd == NULL)
+	 continue;
+      Reader->Opened[I] = 1;
+      rpmHeader hdr = NULL;
+      Reader->Results[I] = rpmReadPackageFile(ts, fd, Reader->Files[I], &hdr);
+      Reader->Headers[I] = hdr;
+      Fclose(fd);
+   }
+   rpmtsFree(ts);
+   return 0;
+}
+
+// RPMLibPM::ReadHeaders - Read the headers of packages to install	/*{{{*/
+// ---------------------------------------------------------------------
+/* Reading a package checks its digests and signatures, which is most of
+   the work done before the transaction check. The files are spread over
+   RPM::Read-Threads threads, each with a transaction set of its own, and
+   the headers are returned in the order of Files. Entries that could not
+   be read are NULL and have been reported. */
+bool pkgRPMLibPM::ReadHeaders(vector<const char*> &Files,
+			      vector<rpmHeader> &Headers)
+{
+   Headers.assign(Files.size(), NULL);
+   rpmHeaderReader Reader(Files, Headers);
+   Reader.VSFlags = rpmtsVSFlags(TS);
+   Reader.RootDir = _config->Find("RPM::RootDir", "/");
+
+   unsigned long Threads = 1;
+#ifdef HAVE_PTHREAD
+   // Reading a package goes through the keyring and the macro context,
+   // global state which older rpm releases do not lock
+#if RPM_VERSION >= 0x040e00
+   long CPUs = sysconf(_SC_NPROCESSORS_ONLN);
+   if (CPUs < 1)
+      CPUs = 1;
+   Threads = _config->FindI("RPM::Read-Threads", CPUs > 8 ? 8 : CPUs);
+   if (Threads > Files.size())
+      Threads = Files.size();
+#endif
+   pthread_mutex_init(&Reader.Lock, NULL);
+   vector<pthread_t> Pool;
+   for (unsigned long I = 1; I < Threads; I++)
+   {
+      pthread_t Thread;
+      if (pthread_create(&Thread, NULL, rpmReadHeaders, &Reader) != 0)
+	 break;
+      Pool.push_back(Thread);
+   }
+#endif
+
+   // This thread reads as well, and alone when no threads are available
+   rpmReadHeaders(&Reader);
+
+#ifdef HAVE_PTHREAD
+   for (vector<pthread_t>::iterator I = Pool.begin(); I != Pool.end(); I++)
+      pthread_join(*I, NULL);
+   pthread_mutex_destroy(&Reader.Lock);
+#endif
+
+   for (unsigned long I = 0; I != Files.size(); I++)
+   {
+      int rc = Reader.Results[I];
+      if (Reader.Opened[I] == 0)
+	 _error->Error(_("Failed opening %s"), Files[I]);
+      else if (rc != RPMRC_OK && rc != RPMRC_NOTTRUSTED && rc != RPMRC_NOKEY)
+	 _error->Error(_("Failed reading file %s"), Files[I]);
+      else
+	 continue;
+      if (Headers[I] != NULL)
+	 headerFree(Headers[I]);
+      Headers[I] = NULL;
+   }
+   return true;
+}
+									/*}}}*/
+
+// Orders indexes into the uninstall list by rpmdb instance
+struct InstanceCompare
+{
+   vector<unsigned int> &Offsets;
+   InstanceCompare(vector<unsigned int> &Offsets) : Offsets(Offsets) {}
+   bool operator() (unsigned long A, unsigned long B) const
+      {return Offsets[A] < Offsets[B];}
+};
+
 bool pkgRPMLibPM::AddToTransaction(Item::RPMOps op, vector<const char*> &files)
 {
    int rc;
-   FD_t fd;
    rpmHeader hdr;
 
-   for (vector<const char*>::const_iterator I = files.begin(); I != files.end(); I++)
+   if (op != Item::RPMErase)
    {
-      int upgrade = 0;
+      int upgrade = (op == Item::RPMUpgrade) ? 1 : 0;
+      vector<rpmHeader> Headers;
+      ReadHeaders(files, Headers);
+      for (unsigned long I = 0; I != files.size(); I++)
+      {
+	 if (Headers[I] == NULL)
+	    continue;
+	 rc = rpmtsAddInstallElement(TS, Headers[I], files[I], upgrade, 0);
+	 if (rc)
+	    _error->Error(_("Failed adding %s to transaction %s"),
+			  files[I], "(install)");
+	 headerFree(Headers[I]);
+      }
+      return true;
+   }
 
-      switch (op)
+   // Visit the instances in ascending order, which keeps the reads in
+   // the Packages database sequential
+   vector<unsigned long> Order;
+   vector<unsigned int> Offsets;
+   vector<unsigned long> ByName;
+   bool Known = (Uninstall.size() == files.size());
+   bool ByOffset = (_config->FindB("RPM::Erase-By-Offset",true) == true &&
+		    Known == true);
+   for (unsigned long I = 0; I != files.size(); I++)
+   {
+      Order.push_back(I);
+      if (ByOffset == true)
+	 Offsets.push_back(Uninstall[I].Offset);
+   }
+   if (ByOffset == true)
+      sort(Order.begin(), Order.end(), InstanceCompare(Offsets));
+
+   for (vector<unsigned long>::const_iterator O = Order.begin(); O != Order.end(); O++)
+   {
+      const char *File = files[*O];
+      rpmdbMatchIterator MI;
+
+      // Jump straight to the header recorded in the cache, as long as
+      // it still is the package we expect there
+      if (ByOffset == true && Uninstall[*O].Offset != 0)
       {
-	 case Item::RPMUpgrade:
-	    upgrade = 1;
-	 case Item::RPMInstall:
-	    fd = Fopen(*I, "r.ufdio");
-	    if (fd == NULL)
-	       _error->Error(_("Failed opening %s"), *I);
-            rc = rpmReadPackageFile(TS, fd, *I, &hdr);
-	    if (rc != RPMRC_OK && rc != RPMRC_NOTTRUSTED && rc != RPMRC_NOKEY)
-	       _error->Error(_("Failed reading file %s"), *I);
-	    rc = rpmtsAddInstallElement(TS, hdr, *I, upgrade, 0);
+	 raptDbOffset Offset = Uninstall[*O].Offset;
+	 MI = raptInitIterator(TS, RPMDBI_PACKAGES, &Offset, sizeof(Offset));
+	 hdr = rpmdbNextIterator(MI);
+	 bool Found = false;
+	 if (hdr != NULL)
+	 {
+	    raptHeader h(hdr);
+	    string Name;
+	    Found = (h.getTag(RPMTAG_NAME, Name) == true &&
+		     Name == Uninstall[*O].Name);
+	 }
+	 if (Found == true)
+	 {
+	    rc = rpmtsAddEraseElement(TS, hdr, Offset);
 	    if (rc)
 	       _error->Error(_("Failed adding %s to transaction %s"),
-			     *I, "(install)");
-	    headerFree(hdr);
-	    Fclose(fd);
-	    break;
-
-	 case Item::RPMErase:
-            rpmdbMatchIterator MI;
-	    MI = raptInitIterator(TS, RPMDBI_LABEL, *I, 0);
-	    while ((hdr = rpmdbNextIterator(MI)) != NULL) 
-	    {
-	       unsigned int recOffset = rpmdbGetIteratorOffset(MI);
-	       if (recOffset) {
-		  rc = rpmtsAddEraseElement(TS, hdr, recOffset);
-		  if (rc)
-		     _error->Error(_("Failed adding %s to transaction %s"),
-				   *I, "(erase)");
-	       }
-	    }
-	    MI = rpmdbFreeIterator(MI);
-	    break;
+			     File, "(erase)");
+	 }
+	 MI = rpmdbFreeIterator(MI);
+	 if (Found == true)
+	    continue;
       }
+
+      // Plain names are all looked up together below
+      if (Known == true && Uninstall[*O].Dup == false)
+      {
+	 ByName.push_back(*O);
+	 continue;
+      }
+
+      MI = raptInitIterator(TS, RPMDBI_LABEL, File, 0);
+      while ((hdr = rpmdbNextIterator(MI)) != NULL) 
+      {
+	 unsigned int recOffset = rpmdbGetIteratorOffset(MI);
+	 if (recOffset) {
+	    rc = rpmtsAddEraseElement(TS, hdr, recOffset);
+	    if (rc)
+	       _error->Error(_("Failed adding %s to transaction %s"),
+			     File, "(erase)");
+	 }
+      }
+      MI = rpmdbFreeIterator(MI);
    }
+
+   if (ByName.empty() == false)
+      return EraseByName(ByName, files);
    return true;
 }
 
+// Add the packages not found by instance to the transaction, matching
+// every header of their names against the arch like name.arch labels do.
+// This is only the fallback for instances the cache got wrong, such as
+// after the rpmdb was changed behind our back.
+bool pkgRPMLibPM::EraseByName(vector<unsigned long> const &Items,
+			      vector<const char*> &files)
+{
+   bool Res = true;
+   vector<string> Names;
+   for (vector<unsigned long>::const_iterator I = Items.begin();
+	I != Items.end(); I++)
+      Names.push_back(Uninstall[*I].Name);
+   sort(Names.begin(), Names.end());
+   Names.erase(unique(Names.begin(), Names.end()), Names.end());
+
+   vector<pair<unsigned long,raptDbOffset> > Matches;
+   if (RPMDBHandler::FindNames(TS, Names, false, Matches) == false)
+      return false;
+
+   // Read the headers in the order they are stored
+   vector<raptDbOffset> Offsets;
+   for (unsigned long M = 0; M != Matches.size(); M++)
+      Offsets.push_back(Matches[M].second);
+   vector<unsigned long> Order;
+   for (unsigned long M = 0; M != Matches.size(); M++)
+      Order.push_back(M);
+   sort(Order.begin(), Order.end(), InstanceCompare(Offsets));
+
+   for (vector<unsigned long>::const_iterator M = Order.begin();
+	M != Order.end(); M++)
+   {
+      raptDbOffset Offset = Matches[*M].second;
+      const string &Name = Names[Matches[*M].first];
+      rpmdbMatchIterator MI;
+      MI = raptInitIterator(TS, RPMDBI_PACKAGES, &Offset, sizeof(Offset));
+      rpmHeader hdr = rpmdbNextIterator(MI);
+      string Arch;
+      if (hdr != NULL)
+	 raptHeader(hdr).getTag(RPMTAG_ARCH, Arch);
+      for (vector<unsigned long>::const_iterator I = Items.begin();
+	   hdr != NULL && I != Items.end(); I++)
+      {
+	 if (Uninstall[*I].Name != Name || Uninstall[*I].Arch != Arch)
+	    continue;
+	 if (rpmtsAddEraseElement(TS, hdr, Offset) != 0)
+	    Res = _error->Error(_("Failed adding %s to transaction %s"),
+				files[*I], "(erase)");
+      }
+      MI = rpmdbFreeIterator(MI);
+   }
+   return Res;
+}
+
 bool pkgRPMLibPM::Process(vector<const char*> &install, 
 			  vector<const char*> &upgrade,
 			  vector<const char*> &uninstall)
@@ -752,8 +1023,9 @@ bool pkgRPMLibPM::Process(vector<const char*> &install,
        notifyFlags |= INSTALL_HASH;
    }
 
-   if (uninstall.empty() == false)
-       AddToTransaction(Item::RPMErase, uninstall);
+   if (uninstall.empty() == false &&
+       AddToTransaction(Item::RPMErase, uninstall) == false)
+      goto exit;
    if (install.empty() == false)
        AddToTransaction(Item::RPMInstall, install);
    if (upgrade.empty() == false)
@@ -39,7 +39,20 @@ class pkgRPMPM : public pkgPackageManager
    };
    vector<Item> List;
 
+   // Where the packages to remove live in the rpmdb, in the order of the
+   // uninstall list handed to Process. Offset is 0 when it isn't known.
+   // Dup is set for Allow-Duplicated packages, labelled with a version.
+   struct DBInstance
+   {
+      string Name;
+      string Arch;
+      bool Dup;
+      unsigned int Offset;
+   };
+   vector<DBInstance> Uninstall;
+
    // Helpers
+   DBInstance FindInstance(PkgIterator Pkg);
    bool RunScripts(const char *Cnf);
    bool RunScriptsWithPkgs(const char *Cnf);
    
@@ -80,7 +93,10 @@ class pkgRPMLibPM : public pkgRPMPM
    rpmts TS;
 
    bool ParseRpmOpts(const char *Cnf, int *tsFlags, int *probFilter);
+   bool ReadHeaders(vector<const char*> &Files, vector<rpmHeader> &Headers);
    bool AddToTransaction(Item::RPMOps op, vector<const char*> &files);
+   bool EraseByName(vector<unsigned long> const &Items,
+		    vector<const char*> &files);
    virtual bool Process(vector<const char*> &install,
 			vector<const char*> &upgrade,
 			vector<const char*> &uninstall);
@@ -20,6 +20,7 @@
 #include "rpmsystem.h"
 
 #include <apt-pkg/error.h>
+#include <apt-pkg/profile.h>
 #include <apti18n.h>
 
 using namespace std;
@@ -45,7 +46,7 @@ rpmRecordParser::rpmRecordParser(string File, pkgCache &Cache)
 	 Handler = repomdXML(File).CreateHandler();
 #endif
       else
-	 Handler = new RPMFileHandler(File);
+	 Handler = new RPMMapFileHandler(File);
    }
 }
 									/*}}}*/
@@ -66,6 +67,7 @@ rpmRecordParser::~rpmRecordParser()
 /* */
 bool rpmRecordParser::Jump(pkgCache::VerFileIterator const &Ver)
 {
+   Profile::Count(Profile::HeadersParsed);
    return Handler->Jump(Ver->Offset);
 }
 									/*}}}*/
@@ -153,6 +155,67 @@ string rpmRecordParser::SourcePkg()
    return srpm.substr(0,idx1);
 }
 									/*}}}*/
+// RecordParser::Section - Return the group of the package		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+string rpmRecordParser::Section()
+{
+   return Handler->Group();
+}
+									/*}}}*/
+// RecordParser::Version - Return the full version of the package	/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+string rpmRecordParser::Version()
+{
+   return Handler->EVR();
+}
+									/*}}}*/
+// RecordParser::Arch - Return the architecture of the package		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+string rpmRecordParser::Arch()
+{
+   return Handler->Arch();
+}
+									/*}}}*/
+// RecordParser::Size - Return the size of the archive			/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+unsigned long rpmRecordParser::Size()
+{
+   return Handler->FileSize();
+}
+									/*}}}*/
+// RecordParser::InstalledSize - Return the size once installed		/*{{{*/
+// ---------------------------------------------------------------------
+/* */
+unsigned long rpmRecordParser::InstalledSize()
+{
+   return Handler->InstalledSize();
+}
+									/*}}}*/
+// RecordParser::Depends - Return the relations of one type		/*{{{*/
+// ---------------------------------------------------------------------
+/* Only the one tag set of the header is read for them. */
+bool rpmRecordParser::Depends(unsigned int Type, vector<pkgRecordDep> &Deps)
+{
+   vector<Dependency*> List;
+   bool Res = Handler->PRCO(Type, List);
+   for (vector<Dependency*>::const_iterator I = List.begin();
+	I != List.end(); I++)
+   {
+      pkgRecordDep Dep;
+      Dep.Name = (*I)->Name;
+      Dep.Version = (*I)->Version;
+      Dep.Op = (*I)->Op;
+      Dep.Type = (*I)->Type;
+      Deps.push_back(Dep);
+      delete *I;
+   }
+   return Res;
+}
+									/*}}}*/
 
 void rpmRecordParser::BufCat(const char *text)
 {
@@ -186,36 +249,13 @@ void rpmRecordParser::BufCatTag(const char *tag, const char *value)
    BufCat(value);
 }
 
-void rpmRecordParser::BufCatDep(Dependency *Dep)
+void rpmRecordParser::BufCatDeps(const char *tag,
+				 vector<pkgRecordDep> const &Deps,
+				 unsigned int Type)
 {
-   string buf;
-
-   BufCat(Dep->Name.c_str());
-   if (Dep->Version.empty() == false) 
-   {
-      BufCat(" ");
-      switch (Dep->Op) {
-	 case pkgCache::Dep::Less:
-	    buf += "<";
-	    break;
-	 case pkgCache::Dep::LessEq:
-	    buf += "<=";
-	    break;
-	 case pkgCache::Dep::Equals: 
-	    buf += "=";
-	    break;
-	 case pkgCache::Dep::Greater:
-	    buf += ">";
-	    break;
-	 case pkgCache::Dep::GreaterEq:
-	    buf += ">=";
-	    break;
-      }
-
-      BufCat(buf.c_str());
-      BufCat(" ");
-      BufCat(Dep->Version.c_str());
-   }
+   string List = DepList(Deps, Type);
+   if (List.empty() == false)
+      BufCatTag(tag, List.c_str());
 }
 
 void rpmRecordParser::BufCatDescr(const char *descr)
@@ -246,100 +286,48 @@ void rpmRecordParser::GetRec(const char *&Start,const char *&Stop)
 
    BufUsed = 0;
 
-   BufCatTag("Package: ", Handler->Name().c_str());
+   BufCatTag("Package: ", Name().c_str());
 
-   BufCatTag("\nSection: ", Handler->Group().c_str());
+   BufCatTag("\nSection: ", Section().c_str());
 
-   snprintf(buf, sizeof(buf), "%lu", Handler->InstalledSize());
+   snprintf(buf, sizeof(buf), "%lu", InstalledSize());
    BufCatTag("\nInstalled Size: ", buf);
 
-   BufCatTag("\nPackager: ", Handler->Packager().c_str());
+   BufCatTag("\nPackager: ", Maintainer().c_str());
    //BufCatTag("\nVendor: ", Handler->Vendor().c_str());
    
-   BufCat("\nVersion: ");
-   
-   BufCat(Handler->EVR().c_str());
-
-
-   vector<Dependency*> Deps, Provides, Obsoletes, Conflicts;
-   vector<Dependency*>::const_iterator I;
-   bool start = true;
-
-   Handler->PRCO(pkgCache::Dep::Depends, Deps);
-   for (I = Deps.begin(); I != Deps.end(); I++) {
-      if ((*I)->Type != pkgCache::Dep::PreDepends)
-	 continue;
-      if (start) {
-	 BufCat("\nPre-Depends: ");
-	 start = false;
-      } else {
-	 BufCat(", ");
-      }
-      BufCatDep(*I);
-   }
+   BufCatTag("\nVersion: ", Version().c_str());
 
-   start = true;
-   for (I = Deps.begin(); I != Deps.end(); I++) {
-      if ((*I)->Type != pkgCache::Dep::Depends)
-	 continue;
-      if (start) {
-	 BufCat("\nDepends: ");
-	 start = false;
-      } else {
-	 BufCat(", ");
-      }
-      BufCatDep(*I);
-   }
-      
-   Handler->PRCO(pkgCache::Dep::Conflicts, Conflicts);
-   start = true;
-   for (I = Conflicts.begin(); I != Conflicts.end(); I++) {
-      if (start) {
-	 BufCat("\nConflicts: ");
-	 start = false;
-      } else {
-	 BufCat(", ");
-      }
-      BufCatDep(*I);
-   }
+   vector<pkgRecordDep> Deps;
+   Depends(pkgCache::Dep::Depends, Deps);
+   BufCatDeps("\nPre-Depends: ", Deps, pkgCache::Dep::PreDepends);
+   BufCatDeps("\nDepends: ", Deps, pkgCache::Dep::Depends);
 
-   Handler->PRCO(pkgCache::Dep::Provides, Provides);
-   start = true;
-   for (I = Provides.begin(); I != Provides.end(); I++) {
-      if (start) {
-	 BufCat("\nProvides: ");
-	 start = false;
-      } else {
-	 BufCat(", ");
-      }
-      BufCatDep(*I);
-   }
+   Deps.clear();
+   Depends(pkgCache::Dep::Conflicts, Deps);
+   BufCatDeps("\nConflicts: ", Deps, pkgCache::Dep::Conflicts);
 
-   Handler->PRCO(pkgCache::Dep::Obsoletes, Obsoletes);
-   start = true;
-   for (I = Obsoletes.begin(); I != Obsoletes.end(); I++) {
-      if (start) {
-	 BufCat("\nObsoletes: ");
-	 start = false;
-      } else {
-	 BufCat(", ");
-      }
-      BufCatDep(*I);
-   }
+   Deps.clear();
+   Depends(pkgCache::Dep::Provides, Deps);
+   BufCatDeps("\nProvides: ", Deps, pkgCache::Dep::Provides);
+
+   Deps.clear();
+   Depends(pkgCache::Dep::Obsoletes, Deps);
+   BufCatDeps("\nObsoletes: ", Deps, pkgCache::Dep::Obsoletes);
 
-   BufCatTag("\nArchitecture: ", Handler->Arch().c_str());
+   BufCatTag("\nArchitecture: ", Arch().c_str());
    
-   snprintf(buf, sizeof(buf), "%lu", Handler->FileSize());
+   snprintf(buf, sizeof(buf), "%lu", Size());
    BufCatTag("\nSize: ", buf);
 
-   BufCatTag("\nHash: ", Handler->Hash().c_str());
+   BufCatTag("\nHash: ", Hash().c_str());
 
    BufCatTag("\nFilename: ", Handler->FileName().c_str());
 
-   BufCatTag("\nSummary: ", Handler->Summary().c_str());
+   BufCatTag("\nSummary: ", ShortDesc().c_str());
    BufCat("\nDescription: ");
    BufCat("\n");
-   BufCatDescr(Handler->Description().c_str());
+   BufCatDescr(LongDesc().c_str());
    BufCat("\n");
    
    Start = Buffer;
@@ -33,7 +33,8 @@ class rpmRecordParser : public pkgRecords::Parser
    void BufCat(const char *text);
    void BufCat(const char *begin, const char *end);
    void BufCatTag(const char *tag, const char *value);
-   void BufCatDep(Dependency *Dep);
+   void BufCatDeps(const char *tag, vector<pkgRecordDep> const &Deps,
+		   unsigned int Type);
    void BufCatDescr(const char *descr);
 
    protected:
@@ -54,6 +55,13 @@ class rpmRecordParser : public pkgRecords::Parser
    virtual string LongDesc();
    virtual string Name();
 
+   virtual string Section();
+   virtual string Version();
+   virtual string Arch();
+   virtual unsigned long Size();
+   virtual unsigned long InstalledSize();
+   virtual bool Depends(unsigned int Type, vector<pkgRecordDep> &Deps);
+
    virtual bool ChangeLog(vector<ChangeLogEntry *> &ChangeLogs);
    virtual bool FileList(vector<string> &Files);
 
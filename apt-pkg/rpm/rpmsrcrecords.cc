@@ -43,7 +43,7 @@ rpmSrcRecordParser::rpmSrcRecordParser(string File,pkgIndexFile const *Index)
       Handler = repomdXML(File).CreateHandler();
 #endif
    else
-      Handler = new RPMFileHandler(File);
+      Handler = new RPMMapFileHandler(File);
 }
 									/*}}}*/
 // SrcRecordParser::~rpmSrcRecordParser - Destructor			/*{{{*/
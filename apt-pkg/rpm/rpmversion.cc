@@ -18,6 +18,7 @@
 #include "rapttypes.h"
 #include "rpmversion.h"
 #include <apt-pkg/pkgcache.h>
+#include <apt-pkg/profile.h>
 
 #include <rpm/rpmlib.h>
 
@@ -81,6 +82,7 @@ static void ParseVersion(char *evr,
 int rpmVersioningSystem::DoCmpVersion(const char *A,const char *AEnd,
 				      const char *B,const char *BEnd)
 {
+   Profile::Count(Profile::VersionsCompared);
    size_t alen = AEnd-A;
    size_t blen = BEnd-B;
    char AVer[alen+1], BVer[blen+1];
@@ -291,6 +291,7 @@ void pkgSourceList::Reset()
    for (const_iterator I = SrcList.begin(); I != SrcList.end(); I++)
       delete *I;
    SrcList.erase(SrcList.begin(),SrcList.end());
+   MirrorList.erase(MirrorList.begin(),MirrorList.end());
    // CNC:2003-11-21
    _system->AddSourceFiles(SrcList);
 }
@@ -383,6 +384,21 @@ bool pkgSourceList::ReadAppend(string File)
 	    return _error->Error(_("Unknown vendor ID '%s' in line %u of source list %s"),
 				 VendorID.c_str(),CurLine,File.c_str());
       }
+
+      // Mirror set, hand only the primary URI to the type parser
+      string Line;
+      const char *End = C;
+      for (; *End != 0 && isspace(*End) == 0; End++);
+      string Word(C,End);
+      if (Word.find('|') != string::npos)
+      {
+	 vector<string> Set;
+	 if (ParseMirrorSet(Word,Set) == false)
+	    return _error->Error(_("Malformed line %u in source list %s (mirror set)"),CurLine,File.c_str());
+	 MirrorList.push_back(Set);
+	 Line = string(Word,0,Word.find('|')) + End;
+	 C = Line.c_str();
+      }
       
       if (Parse->ParseLine(SrcList,Vndr,C,CurLine,File) == false)
 	 return false;
@@ -405,6 +421,57 @@ bool pkgSourceList::FindIndex(pkgCache::PkgFileIterator File,
       }
    }
    
+   return false;
+}
+									/*}}}*/
+// SourceList::ParseMirrorSet - Split a '|' separated list of URIs	/*{{{*/
+// ---------------------------------------------------------------------
+/* The URIs are normalized the same way Type::FixupURI does it so that
+   they can be matched by prefix against the archive URIs of the index
+   files. */
+bool pkgSourceList::ParseMirrorSet(string Word,vector<string> &Set) const
+{
+   string::size_type Start = 0;
+   while (Start <= Word.length())
+   {
+      string::size_type Stop = Word.find('|',Start);
+      if (Stop == string::npos)
+	 Stop = Word.length();
+
+      string URI;
+      string Raw(Word,Start,Stop - Start);
+      const char *C = Raw.c_str();
+      if (ParseQuoteWord(C,URI) == false || URI.find(':') == string::npos)
+	 return false;
+      URI = SubstVar(URI,"$(ARCH)",_config->Find("APT::Architecture"));
+      if (URI[URI.size() - 1] != '/')
+	 URI += '/';
+      Set.push_back(URI);
+
+      Start = Stop + 1;
+   }
+   return Set.size() > 1;
+}
+									/*}}}*/
+// SourceList::GetMirrors - Alternative URIs for an archive		/*{{{*/
+// ---------------------------------------------------------------------
+/* Returns the URI rewritten for every other member of the mirror set
+   whose primary URI is a prefix of it. */
+bool pkgSourceList::GetMirrors(string URI,vector<string> &Mirrors) const
+{
+   for (vector<vector<string> >::const_iterator I = MirrorList.begin();
+	I != MirrorList.end(); I++)
+   {
+      const string &Primary = I->front();
+      if (URI.compare(0,Primary.length(),Primary) != 0)
+	 continue;
+
+      string Rest(URI,Primary.length());
+      for (vector<string>::const_iterator M = I->begin() + 1;
+	   M != I->end(); M++)
+	 Mirrors.push_back(*M + Rest);
+      return true;
+   }
    return false;
 }
 									/*}}}*/
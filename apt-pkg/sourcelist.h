@@ -21,6 +21,10 @@
    The vendor machanism is similar, except the vendor types are hard 
    wired. Before loading the source list the vendor list is loaded.
    This doesn't load key data, just the checks to preform.
+
+   A source line may name several equivalent base URIs separated by '|'.
+   The first one is used for the index files, the others are kept as a
+   mirror set and offered to the acquire system when fetching archives.
    
    ##################################################################### */
 									/*}}}*/
@@ -85,6 +89,11 @@ class pkgSourceList
    vector<pkgIndexFile *> SrcList;
    vector<Vendor *> VendorList;
 
+   // Mirror sets, the first URI of each set is the primary one
+   vector<vector<string> > MirrorList;
+
+   bool ParseMirrorSet(string Word,vector<string> &Set) const;
+
    public:
 
    bool ReadMainList();
@@ -104,6 +113,7 @@ class pkgSourceList
 
    bool FindIndex(pkgCache::PkgFileIterator File,
 		  pkgIndexFile *&Found) const;
+   bool GetMirrors(string URI,vector<string> &Mirrors) const;
    bool GetIndexes(pkgAcquire *Owner) const;
 
    // CNC:2002-07-04
@@ -32,6 +32,7 @@
 #include <apt-pkg/sourcelist.h>
 #include <apt-pkg/algorithms.h>
 #include <apt-pkg/acquire-item.h>
+#include <apt-pkg/packagemanager.h>
 #include <apt-pkg/strutl.h>
 #include <apt-pkg/clean.h>
 #include <apt-pkg/srcrecords.h>
@@ -304,16 +305,25 @@ bool InstallPackages(CacheFile &Cache,bool ShwKept,bool Ask = true,
    
    // Create the download object
    AcqTextStatus Stat(ScreenWidth,_config->FindI("quiet",0));   
-   pkgAcquire Fetcher(&Stat);
+   pkgPipelinedAcquire Fetcher(&Stat);
 
    // Read the source list
    pkgSourceList List;
    if (List.ReadMainList() == false)
       return _error->Error(_("The list of sources could not be read."));
    
+   /* Installing while downloading is only possible when everything is
+      going to be installed in this run, missing archives can't be fixed
+      up after parts of the transaction are done */
+   bool Pipelined = (_config->FindB("APT::Get::Pipeline-Install",false) == true &&
+		     _config->FindB("APT::Get::Download-Only",false) == false &&
+		     _config->FindB("APT::Get::Download",true) == true &&
+		     _config->FindB("APT::Get::Fix-Missing",false) == false &&
+		     _config->FindB("APT::Get::Print-URIs") == false);
+
    // Create the package manager and prepare to download
    SPtr<pkgPackageManager> PM= _system->CreatePM(Cache);
-   if (PM->GetArchives(&Fetcher,&List,&Recs) == false || 
+   if (PM->GetArchives(&Fetcher,&List,&Recs,Pipelined) == false || 
        _error->PendingError() == true)
       return false;
 
@@ -455,7 +465,21 @@ bool InstallPackages(CacheFile &Cache,bool ShwKept,bool Ask = true,
 	 }	 
       }
       
-      if (Fetcher.Run() == pkgAcquire::Failed)
+      // The package manager needs the lock while batches are installed
+      if (Pipelined == true)
+      {
+	 _system->UnLock();
+	 Fetcher.Pipeline(PM);
+      }
+      pkgAcquire::RunResult FetchRes = Fetcher.Run();
+      if (Pipelined == true)
+      {
+	 Pipelined = false;
+	 if (Fetcher.Finish() == false)
+	    FetchRes = pkgAcquire::Failed;
+	 _system->Lock();
+      }
+      if (FetchRes == pkgAcquire::Failed)
 	 return false;
 
       // CNC:2003-02-24
@@ -2276,6 +2300,7 @@ int main(int argc,const char *argv[])
       {'t',"default-release","APT::Default-Release",CommandLine::HasArg},
       {0,"download","APT::Get::Download",0},
       {0,"fix-missing","APT::Get::Fix-Missing",0},
+      {0,"pipeline","APT::Get::Pipeline-Install",0},
       {0,"ignore-hold","APT::Ignore-Hold",0},      
       {0,"upgrade","APT::Get::upgrade",0},
       {0,"force-yes","APT::Get::force-yes",0},
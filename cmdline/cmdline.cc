@@ -10,11 +10,16 @@
 #include "cmdline.h"
 
 #include <regex.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <fnmatch.h>
 #include <langinfo.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 using namespace std;
 
 // YnPrompt - Yes No Prompt.						/*{{{*/
@@ -1026,6 +1031,46 @@ bool cmdDumpPackage(CommandLine &CmdL, pkgCache &Cache)
    return true;
 }
 									/*}}}*/
+// RecordText - The record as show and search --full print it		/*{{{*/
+// ---------------------------------------------------------------------
+/* APT::Cache::ShowFields limits the output to the comma separated list
+   of fields given, which are then the only ones read from the index. */
+static string RecordText(pkgRecords::Parser &P)
+{
+   string Fields = _config->Find("APT::Cache::ShowFields");
+   if (Fields.empty() == true)
+   {
+      const char *Start;
+      const char *End;
+      P.GetRec(Start,End);
+      return string(Start,End-Start);
+   }
+
+   string Out;
+   string::size_type Pos = 0;
+   while (Pos < Fields.length())
+   {
+      string::size_type Next = Fields.find(',',Pos);
+      if (Next == string::npos)
+	 Next = Fields.length();
+      string Tag = Fields.substr(Pos,Next - Pos);
+      Pos = Next + 1;
+
+      string::size_type B = Tag.find_first_not_of(' ');
+      if (B == string::npos)
+	 continue;
+      Tag = Tag.substr(B,Tag.find_last_not_of(' ') - B + 1);
+
+      // Continuation lines of multi line fields are indented
+      string Value = P.Field(Tag);
+      for (string::size_type I = Value.find('\n'); I != string::npos;
+	   I = Value.find('\n',I + 2))
+	 Value.insert(I + 1," ");
+      Out += Tag + ": " + Value + "\n";
+   }
+   return Out;
+}
+									/*}}}*/
 // DisplayRecord - Displays the complete record for the package		/*{{{*/
 // ---------------------------------------------------------------------
 /* This displays the package record from the proper package index file. 
@@ -1042,12 +1087,12 @@ bool cmdDisplayRecord(pkgCache::VerIterator V, pkgCache &Cache)
       
 // CNC:2002-07-24
 #if HAVE_RPM
-   pkgRecords Recs(Cache);
-   pkgRecords::Parser &P = Recs.Lookup(Vf);
-   const char *Start;
-   const char *End;
-   P.GetRec(Start,End);
-   cout << string(Start,End-Start) << endl;
+   // Only the file holding the record needs to be opened
+   pkgRecords Recs(Cache,true);
+   pkgRecords::Parser *P = Recs.Find(Vf);
+   if (P == 0)
+      return false;
+   cout << RecordText(*P) << endl;
 #else
    // Check and load the package list file
    pkgCache::PkgFileIterator I = Vf.File();
@@ -1671,6 +1716,110 @@ struct ExVerFile
    bool NameMatch;
 };
 
+// SearchRecord - Match a record and format it for output
+static bool SearchRecord(pkgRecords::Parser &P,regex_t *Patterns,
+			 unsigned NumPatterns,bool NameMatch,bool ShowFull,
+			 string &Out)
+{
+   if (NameMatch == false)
+   {
+      string LongDesc = P.LongDesc(); 
+      // CNC 2004-04-10
+      string ShortDesc = P.ShortDesc();
+      for (unsigned I = 0; I != NumPatterns; I++)
+      {
+	 if (regexec(&Patterns[I],LongDesc.c_str(),0,0,0) != 0 &&
+	     regexec(&Patterns[I],ShortDesc.c_str(),0,0,0) != 0)
+	    return false;
+      }
+   }
+
+   if (ShowFull == true)
+      Out = RecordText(P);
+   else
+      Out = P.Name() + " - " + P.ShortDesc();
+   return true;
+}
+
+// Work shared by the threads searching the records
+struct SearchState
+{
+   pkgCache &Cache;
+   ExVerFile *VFList;
+   unsigned long Count;
+   const char **Args;
+   unsigned NumPatterns;
+   bool ShowFull;
+
+   // Per entry: 0 no match, 1 match, 2 left to the calling thread
+   vector<char> Result;
+   vector<string> Output;
+   unsigned long Next;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t Lock;
+#endif
+
+   SearchState(pkgCache &Cache,ExVerFile *VFList,unsigned long Count) :
+      Cache(Cache), VFList(VFList), Count(Count), Result(Count,2),
+      Output(Count), Next(0) {}
+};
+
+#ifdef HAVE_PTHREAD
+// Search runs of the locality sorted list until none is left. Every
+// thread opens the parsers it needs itself, but the records of status files
+// (such as the rpm database) are left to the calling thread, as their
+// parsers may share state. Errors are per thread and simply dropped,
+// failed entries are left to the calling thread as well.
+static void *SearchRecords(void *Arg)
+{
+   SearchState *S = (SearchState *)Arg;
+   const unsigned long Run = 64;
+
+   // regexec() serializes users of the same pattern
+   regex_t *Patterns = new regex_t[S->NumPatterns];
+   for (unsigned I = 0; I != S->NumPatterns; I++)
+      regcomp(&Patterns[I],S->Args[I],REG_EXTENDED | REG_ICASE | REG_NOSUB);
+
+   pkgRecords Recs(S->Cache,true);
+   while (1)
+   {
+      pthread_mutex_lock(&S->Lock);
+      unsigned long Begin = S->Next;
+      S->Next += Run;
+      pthread_mutex_unlock(&S->Lock);
+      if (Begin >= S->Count)
+	 break;
+
+      unsigned long End = Begin + Run;
+      if (End > S->Count)
+	 End = S->Count;
+      for (unsigned long J = Begin; J != End; J++)
+      {
+	 pkgCache::VerFileIterator Vf(S->Cache,S->VFList[J].Vf);
+	 pkgCache::PkgFileIterator File = Vf.File();
+	 if ((File->Flags & pkgCache::Flag::NotSource) != 0)
+	    continue;
+
+	 pkgRecords::Parser *P = Recs.Find(Vf);
+	 if (P == 0)
+	    continue;
+
+	 if (SearchRecord(*P,Patterns,S->NumPatterns,S->VFList[J].NameMatch,
+			  S->ShowFull,S->Output[J]) == true)
+	    S->Result[J] = 1;
+	 else
+	    S->Result[J] = 0;
+      }
+   }
+
+   for (unsigned I = 0; I != S->NumPatterns; I++)
+      regfree(&Patterns[I]);
+   delete [] Patterns;
+   _error->Discard();
+   return 0;
+}
+#endif
+
 bool cmdSearch(CommandLine &CmdL, pkgCache &Cache)
 {
    bool ShowFull = _config->FindB("APT::Cache::ShowFull",false);
@@ -1697,14 +1846,8 @@ bool cmdSearch(CommandLine &CmdL, pkgCache &Cache)
       }      
    }
    
-   // Create the text record parser
-   pkgRecords Recs(Cache);
-   if (_error->PendingError() == true)
-   {
-      for (unsigned I = 0; I != NumPatterns; I++)
-	 regfree(&Patterns[I]);
-      return false;
-   }
+   // Create the text record parser, files are opened as records need them
+   pkgRecords Recs(Cache,true);
    
    ExVerFile *VFList = new ExVerFile[Cache.HeaderP->PackageCount+1];
    memset(VFList,0,sizeof(*VFList)*Cache.HeaderP->PackageCount+1);
@@ -1750,40 +1893,55 @@ bool cmdSearch(CommandLine &CmdL, pkgCache &Cache)
 
    LocalitySort(&VFList->Vf,Cache.HeaderP->PackageCount,sizeof(*VFList));
 
-   // Iterate over all the version records and check them
+   unsigned long Count = 0;
    for (ExVerFile *J = VFList; J->Vf != 0; J++)
+      Count++;
+
+   /* The version records are checked on APT::Cache::Search-Threads
+      threads, each taking runs of the sorted list so reading stays
+      mostly sequential. The results are printed in list order. */
+   SearchState State(Cache,VFList,Count);
+   State.Args = CmdL.FileList + 1;
+   State.NumPatterns = NumPatterns;
+   State.ShowFull = ShowFull;
+
+#ifdef HAVE_PTHREAD
+   unsigned long Threads = 1;
+   // The descriptions are read with headerGet, which expands the i18n
+   // domains through the macro context older rpm releases do not lock
+#if RPM_VERSION >= 0x040e00
+   long CPUs = sysconf(_SC_NPROCESSORS_ONLN);
+   if (CPUs < 1)
+      CPUs = 1;
+   Threads = _config->FindI("APT::Cache::Search-Threads",CPUs > 8 ? 8 : CPUs);
+#endif
+   pthread_mutex_init(&State.Lock, NULL);
+   vector<pthread_t> Pool;
+   for (unsigned long I = 0; Threads > 1 && I < Threads && I*64 < Count; I++)
    {
-      pkgRecords::Parser &P = Recs.Lookup(pkgCache::VerFileIterator(Cache,J->Vf));
+      pthread_t Thread;
+      if (pthread_create(&Thread, NULL, SearchRecords, &State) != 0)
+	 break;
+      Pool.push_back(Thread);
+   }
+   for (vector<pthread_t>::iterator I = Pool.begin(); I != Pool.end(); I++)
+      pthread_join(*I, NULL);
+   pthread_mutex_destroy(&State.Lock);
+#endif
 
-      bool Match = true;
-      if (J->NameMatch == false)
-      {
-	 string LongDesc = P.LongDesc(); 
-	 // CNC 2004-04-10
-	 string ShortDesc = P.ShortDesc();
-	 Match = NumPatterns != 0;
-	 for (unsigned I = 0; I != NumPatterns; I++)
-	 {
-	    if (regexec(&Patterns[I],LongDesc.c_str(),0,0,0) == 0 ||
-		regexec(&Patterns[I],ShortDesc.c_str(),0,0,0) == 0)
-	       Match &= true;
-	    else
-	       Match = false;
-	 }
-      }
-      
-      if (Match == true)
+   // Check what the threads left and print the matches in order
+   for (unsigned long J = 0; J != Count; J++)
+   {
+      if (State.Result[J] == 2)
       {
-	 if (ShowFull == true)
-	 {
-	    const char *Start;
-	    const char *End;
-	    P.GetRec(Start,End);
-	    cout << string(Start,End-Start) << endl;
-	 }	 
-	 else
-	    cout << P.Name() << " - " << P.ShortDesc() << endl;
+	 pkgRecords::Parser *P = Recs.Find(pkgCache::VerFileIterator(Cache,VFList[J].Vf));
+	 if (P != 0 &&
+	     SearchRecord(*P,Patterns,NumPatterns,VFList[J].NameMatch,
+			  ShowFull,State.Output[J]) == true)
+	    State.Result[J] = 1;
       }
+      if (State.Result[J] == 1)
+	 cout << State.Output[J] << endl;
    }
    
    delete [] VFList;
@@ -1798,11 +1956,12 @@ bool cmdSearchFile(CommandLine &CmdL, pkgCache &Cache)
 {
    pkgRecords Recs(Cache);
    pkgDepCache::Policy Plcy;
+   static Configuration::Handle AllVersionsOpt("APT::Cache::AllVersions");
 
    for (const char **I = CmdL.FileList + 1; *I != 0; I++) {
       pkgCache::PkgIterator Pkg = Cache.PkgBegin();
       for (; Pkg.end() == false; Pkg++) {
-	 if (_config->FindB("APT::Cache::AllVersions", false) == true) {
+	 if (AllVersionsOpt.FindB(false) == true) {
 	    pkgCache::VerIterator Ver = Pkg.VersionList();
 	    for (; Ver.end() == false; Ver++) {
 	       pkgRecords::Parser &Parse = Recs.Lookup(Ver.FileList());
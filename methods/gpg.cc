@@ -1,4 +1,3 @@
-
 #include <apt-pkg/error.h>
 #include <apt-pkg/acquire-method.h>
 #include <apt-pkg/strutl.h>
@@ -8,21 +7,157 @@
 #include <unistd.h>
 #include <utime.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/wait.h>
 
+#include <list>
+#include <vector>
+
 #include <apti18n.h>
 
+using std::list;
+using std::vector;
+
 class GPGMethod : public pkgAcqMethod
 {
+   // A signed file being verified. Jobs are answered in the order APT
+   // sent them, which is the order of the method queue.
+   struct Job
+   {
+      FetchItem *Itm;
+      string Path;
+      string TempDir;
+      bool OldStyle;
+      int SigCount;
+      unsigned int Pending;
+      vector<string> KeyIDs;
+      vector<string> Errors;
+   };
+
+   // One gpg run checking a signature of a job, Sig is 0 for old style
+   // files, which gpg both checks and extracts
+   struct Signer
+   {
+      Job *Owner;
+      int Sig;
+      bool Snapshot;
+      pid_t Pid;
+      int Fd;
+      string Output;
+   };
+
+   list<Job *> Jobs;
+   list<Signer> Waiting;
+   list<Signer> Running;
+   unsigned int MaxRunning;
+
+   // The public keys exported once for the whole acquire run, checked
+   // against with gpgv. Empty if the snapshot could not be made.
+   string KeyDir;
+   string Keyring;
+   bool TriedKeyring;
+
    virtual bool Fetch(FetchItem *Itm);
+   virtual void Exit();
+
+   bool SnapshotKeyring();
+   bool Prepare(Job *J);
+   bool MoreQueued();
+   void StartSigners();
+   void WaitSigners();
+   void Report();
+   bool Finish(Job *J);
    
  public:
    
-   GPGMethod() : pkgAcqMethod("1.0",SingleInstance | SendConfig) {}
+   GPGMethod() : pkgAcqMethod("1.0",SingleInstance | Pipeline | SendConfig),
+                 MaxRunning(0), TriedKeyring(false) {}
+};
+
+
+// Hands out the lines of a file read in large blocks. A line keeps its
+// '\n' and stays valid until the next call.
+class LineReader
+{
+   FileFd &Fd;
+   char *Buf;
+   unsigned long Size;
+   unsigned long Start;
+   unsigned long End;
+   bool Eof;
+
+   public:
+
+   bool Next(const char *&Line,unsigned long &Len)
+   {
+      while (1)
+      {
+	 char *NL = (char *)memchr(Buf+Start,'\n',End-Start);
+	 if (NL != NULL || (Eof == true && Start != End))
+	 {
+	    Line = Buf+Start;
+	    Len = (NL != NULL ? NL+1-Line : End-Start);
+	    Start += Len;
+	    return true;
+	 }
+	 if (Eof == true)
+	    return false;
+
+	 // Keep the partial line and fill up the rest of the buffer
+	 memmove(Buf,Buf+Start,End-Start);
+	 End -= Start;
+	 Start = 0;
+	 if (End == Size)
+	 {
+	    Size *= 2;
+	    Buf = (char *)realloc(Buf,Size);
+	 }
+	 unsigned long Actual;
+	 if (Fd.Read(Buf+End,Size-End,&Actual) == false)
+	    return false;
+	 End += Actual;
+	 if (Actual == 0)
+	    Eof = true;
+      }
+   }
+
+   LineReader(FileFd &Fd) : Fd(Fd), Size(64*1024), Start(0), End(0),
+                            Eof(false) {Buf = (char *)malloc(Size);}
+   ~LineReader() {free(Buf);}
 };
 
+// Collects writes to a file and hands them to the kernel in large blocks
+class BlockWriter
+{
+   FileFd &Fd;
+   string Out;
 
-#define STRCMP(buf, conststr) strncmp(buf, conststr, sizeof(conststr)-1)
+   public:
+
+   bool Write(const char *Data,unsigned long Len)
+   {
+      Out.append(Data,Len);
+      if (Out.size() < 64*1024)
+	 return true;
+      return Flush();
+   }
+   bool Flush()
+   {
+      bool Res = Fd.Write(Out.c_str(),Out.size());
+      Out.erase();
+      return Res;
+   }
+
+   BlockWriter(FileFd &Fd) : Fd(Fd) {}
+};
+
+#define STRCMP(buf, len, conststr) \
+   (len < sizeof(conststr)-1 || strncmp(buf, conststr, sizeof(conststr)-1))
 /*
  * extractSignedFile - Extract parts of a gpg signed file in the format
  *         described below.
@@ -56,15 +191,16 @@ class GPGMethod : public pkgAcqMethod
 bool extractSignedFile(string file, string targetPrefix, string targetFile,
 		       bool &oldStyle, int &sigCount)
 {
-   FILE *fin;
-   FILE *fout;
-   char buffer[256];
+   const char *buffer;
+   unsigned long len;
    string tmps;
 
-   fin = fopen(file.c_str(), "r");
-   if (fin == NULL)
+   int fd = open(file.c_str(), O_RDONLY);
+   if (fd < 0)
       return _error->Errno("open", "could not open gpg signed file %s",
 			   file.c_str());
+   FileFd fin(fd);
+   LineReader in(fin);
    
    oldStyle = false;
 
@@ -73,39 +209,40 @@ bool extractSignedFile(string file, string targetPrefix, string targetFile,
    // store the signed file in a separate file
    tmps = targetFile;
 
-   fout = fopen(tmps.c_str(), "w+");
-   if (fout == NULL)
-   {
-      fclose(fin);
+   fd = open(tmps.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0)
       return _error->Errno("fopen", "could not create file %s",
 			   tmps.c_str());
-   }
+   FileFd fout(fd);
+   BlockWriter out(fout);
    while (1)
    {
-      if (fgets(buffer, sizeof(buffer)-1, fin) == NULL)
+      if (in.Next(buffer, len) == false)
       {
 	 Failed = true;
 	 _error->Error("no signatures in file %s", file.c_str());
 	 break;	
       }
 
-      if (STRCMP(buffer, "-----BEGIN") == 0)
+      if (STRCMP(buffer, len, "-----BEGIN") == 0)
 	 break;
 
-      if (fputs(buffer, fout) < 0)
+      if (out.Write(buffer, len) == false)
       {
 	 Failed = true;
 	 _error->Errno("fputs", "error writing to %s", tmps.c_str());
 	 break;
       }
    }
-   fclose(fout);
+   if (Failed == false && out.Flush() == false)
+   {
+      Failed = true;
+      _error->Errno("fputs", "error writing to %s", tmps.c_str());
+   }
+   fout.Close();
 
    if (Failed) 
-   {
-      fclose(fin);
       return false;
-   }
    
    sigCount = 0;
    // now store each of the signatures in a file, separately
@@ -113,7 +250,7 @@ bool extractSignedFile(string file, string targetPrefix, string targetFile,
    {
       char buf[32];
 
-      if (STRCMP(buffer, "-----BEGIN PGP SIGNATURE-----") != 0)
+      if (STRCMP(buffer, len, "-----BEGIN PGP SIGNATURE-----") != 0)
       {
 	 Failed = true;
 	 _error->Error("unexpected data in gpg signed file %s",
@@ -126,73 +263,77 @@ bool extractSignedFile(string file, string targetPrefix, string targetFile,
 
       tmps = targetPrefix+"sig"+string(buf);
       
-      fout = fopen(tmps.c_str(), "w+");
-      if (fout == NULL) 
-      {
-	 fclose(fin);
+      fd = open(tmps.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+      if (fd < 0)
 	 return _error->Errno("fopen", "could not create signature file %s",
 			      tmps.c_str());
-      }
+      FileFd sout(fd);
+      BlockWriter sig(sout);
       while (1)
       {
-	 if (fputs(buffer, fout) < 0)
+	 if (sig.Write(buffer, len) == false)
 	 {
 	    Failed = true;
 	    _error->Errno("fputs", "error writing to %s", tmps.c_str());
 	    break;
 	 }
 
-	 if (STRCMP(buffer, "-----END PGP SIGNATURE-----") == 0)
+	 if (STRCMP(buffer, len, "-----END PGP SIGNATURE-----") == 0)
 	    break;
 
-	 if (fgets(buffer, sizeof(buffer)-1, fin) == NULL)
+	 if (in.Next(buffer, len) == false)
 	 {
 	    Failed = true;
 	    _error->Errno("fgets", "error reading from %s", file.c_str());
 	    break;	 
 	 }
       }
-      fclose(fout);
+      if (Failed == false && sig.Flush() == false)
+      {
+	 Failed = true;
+	 _error->Errno("fputs", "error writing to %s", tmps.c_str());
+      }
+      sout.Close();
 
       if (Failed) 
-      {
-	 fclose(fin);
 	 return false;
-      }
       
-      if (fgets(buffer, sizeof(buffer)-1, fin) == NULL)
+      if (in.Next(buffer, len) == false)
 	 break;
       
       if (buffer[0] == '\n')
 	 break;      
    }
 
-   fclose(fin);
-
-   return true;
+   return Failed == false;
 }
 #undef STRCMP
 
 
 
-const char *getFileSigner(const char *file, const char *sigfile,
-		    const char *outfile, string &signerKeyID)
+/*
+ * startFileSigner - Run gpg to check the signature of a file in the
+ *         background. The status output of gpg can be read from fd
+ *         and is handed to getFileSigner together with the exit status
+ *         once gpg is done. If keyring is given a detached signature is
+ *         checked by gpgv against that keyring alone.
+ */
+const char *startFileSigner(const char *file, const char *sigfile,
+			    const char *outfile, const char *keyring,
+			    pid_t &pid, int &fd)
 {
-   pid_t pid;
-   int fd[2];
-   char buffer[1024];
-   FILE *f;
-   char keyid[64];
-   int status;
-   bool goodsig = false;
-   bool badsig = false;
+   int fds[2];
 
-   if (pipe(fd) < 0)
+   if (pipe(fds) < 0)
       return "could not create pipe";  
 
    pid = fork();
    if (pid < 0)
+   {
+      close(fds[0]);
+      close(fds[1]);
       return "could not spawn new process";
+   }
    else if (pid == 0) 
    {
       string path = _config->Find("Dir::Bin::gpg", GPG );
@@ -200,16 +341,31 @@ const char *getFileSigner(const char *file, const char *sigfile,
       const char *argv[16];
       int argc = 0;
       
-      close(fd[0]);
+      close(fds[0]);
       close(STDERR_FILENO);
       close(STDOUT_FILENO);
-      dup2(fd[1], STDOUT_FILENO);
-      dup2(fd[1], STDERR_FILENO);
+      dup2(fds[1], STDOUT_FILENO);
+      dup2(fds[1], STDERR_FILENO);
       
       unsetenv("LANG");
       unsetenv("LC_ALL");
       unsetenv("LC_MESSAGES");
 
+      if (keyring != NULL && outfile == NULL)
+      {
+	 path = _config->Find("Dir::Bin::gpgv", "gpgv");
+	 argv[argc++] = "gpgv";
+	 argv[argc++] = "--keyring"; argv[argc++] = keyring;
+	 argv[argc++] = "--status-fd"; argv[argc++] = "2";
+	 argv[argc++] = sigfile;
+	 argv[argc++] = file;
+	 argv[argc] = NULL;
+
+	 execvp(path.c_str(), (char**)argv);
+
+	 exit(111);
+      }
+
       argv[argc++] = "gpg";
       argv[argc++] = "--batch";
       argv[argc++] = "--no-secmem-warning";
@@ -235,17 +391,36 @@ const char *getFileSigner(const char *file, const char *sigfile,
       
       exit(111);
    }
-   close(fd[1]);
+   close(fds[1]);
+   SetCloseExec(fds[0], true);
+   fd = fds[0];
+   return NULL;
+}
+
+
+/*
+ * getFileSigner - Work out the key ID of the signer from the status
+ *         output and exit status of a gpg run started by startFileSigner.
+ *         Returns NULL if the signature is good.
+ */
+const char *getFileSigner(string const &output, int status,
+			  string &signerKeyID)
+{
+   char keyid[64];
+   bool goodsig = false;
+   bool badsig = false;
+
    keyid[0] = 0;
-   goodsig = false;
-   
-   f = fdopen(fd[0], "r");
    
-   while (1) {
-      char *ptr, *ptr1;
-      
-      if (!fgets(buffer, 1024, f))
-	 break;
+   string::size_type start = 0;
+   while (start < output.size()) {
+      const char *ptr1;
+      string::size_type end = output.find('\n', start);
+      if (end == string::npos)
+	 end = output.size();
+      string line(output, start, end - start);
+      const char *buffer = line.c_str();
+      start = end + 1;
       
       if (goodsig && keyid[0])
 	 continue;     
@@ -253,11 +428,11 @@ const char *getFileSigner(const char *file, const char *sigfile,
 #define SIGPACK "[GNUPG:] VALIDSIG"
       if ((ptr1 = strstr(buffer, SIGPACK)) != NULL) 
       {
-	 char *sig;
-	 ptr = sig = ptr1 + sizeof(SIGPACK);
-	 while (isxdigit(*ptr) && (size_t)(ptr-sig) < sizeof(keyid)) ptr++;
-	 *ptr = 0;
-	 strcpy(keyid, sig);
+	 const char *sig = ptr1 + sizeof(SIGPACK);
+	 size_t len = 0;
+	 while (isxdigit(sig[len]) && len < sizeof(keyid)-1) len++;
+	 memcpy(keyid, sig, len);
+	 keyid[len] = 0;
       }
 #undef SIGPACK
       
@@ -271,10 +446,7 @@ const char *getFileSigner(const char *file, const char *sigfile,
 	 badsig = true;
 #undef BADSIG
    }
-   fclose(f);
    
-   waitpid(pid, &status, 0);
-
    if (WEXITSTATUS(status) == 0) 
    {
       signerKeyID = string(keyid);
@@ -297,6 +469,20 @@ const char *getFileSigner(const char *file, const char *sigfile,
 }
 
 
+const char *getTmpDir()
+{
+   const char *SysTempDir;
+
+   SysTempDir = getenv("TMPDIR");
+   if (SysTempDir == NULL || !FileExists(SysTempDir)) {
+      SysTempDir = getenv("TMP");
+      if (SysTempDir == NULL || !FileExists(SysTempDir))
+         SysTempDir = "/tmp";
+   }
+   return SysTempDir;
+}
+
+
 bool makeTmpDir(string dir, string &path)
 {
    char *buf;
@@ -332,91 +518,262 @@ void removeTmpDir(string path, int sigCount)
 
 
 
-bool GPGMethod::Fetch(FetchItem *Itm)
+/*
+ * SnapshotKeyring - Export the public keys gpg would check against into
+ *         a keyring of our own. GnuPG then does not have to set up its
+ *         home, trust database and keyrings again for every signature,
+ *         gpgv only reads the exported keys.
+ */
+bool GPGMethod::SnapshotKeyring()
 {
-   URI Get = Itm->Uri;
-   string Path = Get.Host + Get.Path; // To account for relative paths
-   string KeyList;
+   TriedKeyring = true;
+   if (makeTmpDir(getTmpDir(), KeyDir) == false)
+      return false;
+   string File = KeyDir+"/pubring.gpg";
 
-   FetchResult Res;
-   Res.Filename = Itm->DestFile;
-   URIStart(Res);
-   
-   string TempDir;
-   const char *SysTempDir;
+   int fd = open(File.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd < 0)
+      return _error->Errno("open", "could not create file %s", File.c_str());
 
-   SysTempDir = getenv("TMPDIR");
-   if (SysTempDir == NULL || !FileExists(SysTempDir)) {
-      SysTempDir = getenv("TMP");
-      if (SysTempDir == NULL || !FileExists(SysTempDir))
-         SysTempDir = "/tmp";
+   pid_t pid = fork();
+   if (pid < 0)
+   {
+      close(fd);
+      return _error->Errno("fork", "could not spawn new process");
    }
-   if (makeTmpDir(SysTempDir, TempDir) == false)
+   if (pid == 0)
+   {
+      string path = _config->Find("Dir::Bin::gpg", GPG );
+      string pubring = _config->Find("APT::GPG::Pubring");
+      const char *argv[16];
+      int argc = 0;
+
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+      int null = open("/dev/null", O_WRONLY);
+      if (null >= 0)
+	 dup2(null, STDERR_FILENO);
+
+      argv[argc++] = "gpg";
+      argv[argc++] = "--batch";
+      argv[argc++] = "--no-secmem-warning";
+      if (pubring.empty() == false)
+      {
+	 argv[argc++] = "--keyring"; argv[argc++] = pubring.c_str();
+      }
+      argv[argc++] = "--export";
+      argv[argc] = NULL;
+
+      execvp(path.c_str(), (char**)argv);
+
+      exit(111);
+   }
+   close(fd);
+
+   int status;
+   while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+   struct stat Buf;
+   if (WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0 ||
+       stat(File.c_str(), &Buf) != 0 || Buf.st_size == 0)
+      return _error->Error("could not export the gpg public keys");
+
+   Keyring = File;
+   return true;
+}
+
+/*
+ * Prepare - Extract the signatures of a job and queue a gpg run for
+ *         each of them.
+ */
+bool GPGMethod::Prepare(Job *J)
+{
+   if (makeTmpDir(getTmpDir(), J->TempDir) == false)
       return false;
    
-   int SigCount = 0;
-   bool OldStyle = true;
-
-   if (extractSignedFile(Path, TempDir+"/", Itm->DestFile, OldStyle,
-			 SigCount) == false)
+   if (extractSignedFile(J->Path, J->TempDir+"/", J->Itm->DestFile,
+			 J->OldStyle, J->SigCount) == false)
       return false;
 
-   if (OldStyle == true) 
+   Signer S;
+   S.Owner = J;
+   S.Snapshot = (J->OldStyle == false && Keyring.empty() == false);
+   S.Pid = -1;
+   S.Fd = -1;
+   if (J->OldStyle == true) 
    {
-      // Run GPG on file, extract contents and get the key ID of the signer
-      const char *msg = getFileSigner(Path.c_str(), NULL,
-		      		Itm->DestFile.c_str(), KeyList);
-      if (msg != NULL) 
-      {
-	 removeTmpDir(TempDir, SigCount);
-	 return _error->Error(msg);
-      }
+      // GPG extracts the contents and gets the key ID of the signer
+      S.Sig = 0;
+      Waiting.push_back(S);
+      J->Pending = 1;
    }
    else 
    {
-      const char *msg;
-      int i;
-      char buf[32];
-      string KeyID;
-      
       // Check fingerprint for each signature
-      for (i = 1; i <= SigCount; i++) 
+      for (S.Sig = 1; S.Sig <= J->SigCount; S.Sig++) 
+	 Waiting.push_back(S);
+      J->Pending = J->SigCount;
+   }
+   J->KeyIDs.resize(J->Pending);
+   J->Errors.resize(J->Pending);
+   return true;
+}
+
+/*
+ * MoreQueued - True if APT has sent messages which were not handled yet.
+ */
+bool GPGMethod::MoreQueued()
+{
+   if (Messages.empty() == false)
+      return true;
+
+   struct pollfd In;
+   In.fd = InFd;
+   In.events = POLLIN;
+   return poll(&In, 1, 0) > 0;
+}
+
+/*
+ * StartSigners - Start waiting gpg runs until MaxRunning are active.
+ */
+void GPGMethod::StartSigners()
+{
+   while (Waiting.empty() == false && Running.size() < MaxRunning)
+   {
+      Signer S = Waiting.front();
+      Waiting.pop_front();
+
+      Job *J = S.Owner;
+      const char *msg;
+      if (S.Sig == 0)
+	 msg = startFileSigner(J->Path.c_str(), NULL,
+			       J->Itm->DestFile.c_str(), NULL, S.Pid, S.Fd);
+      else
       {
-	 snprintf(buf, sizeof(buf)-1, "%i", i);
-	 
-	 string SigFile = TempDir+"/sig"+string(buf);
-
-	 
-	 // Run GPG on file and get the key ID of the signer
-	 msg = getFileSigner(Itm->DestFile.c_str(), SigFile.c_str(), 
-			     NULL, KeyID);
-	 if (msg != NULL)
-	 {
-	    removeTmpDir(TempDir, SigCount);	       
-	    return _error->Error(msg);
-	 }
-	 if (KeyList.empty())
-	    KeyList = KeyID;
-	 else
-	    KeyList = KeyList+","+KeyID;
+	 char buf[32];
+	 snprintf(buf, sizeof(buf)-1, "%i", S.Sig);
+	 string SigFile = J->TempDir+"/sig"+string(buf);
+	 msg = startFileSigner(J->Itm->DestFile.c_str(), SigFile.c_str(),
+			       NULL, S.Snapshot ? Keyring.c_str() : NULL,
+			       S.Pid, S.Fd);
       }
+
+      if (msg != NULL)
+      {
+	 J->Errors[S.Sig == 0 ? 0 : S.Sig-1] = msg;
+	 J->Pending--;
+	 continue;
+      }
+      Running.push_back(S);
    }
-   
-   removeTmpDir(TempDir, SigCount);
+}
+
+/*
+ * WaitSigners - Collect the output of the running gpg processes until one
+ *         of them is done or APT sends something.
+ */
+void GPGMethod::WaitSigners()
+{
+   vector<struct pollfd> Fds(Running.size()+1);
+   vector<list<Signer>::iterator> Owners;
+   unsigned int N = 0;
+   for (list<Signer>::iterator I = Running.begin(); I != Running.end();
+	I++, N++)
+   {
+      Fds[N].fd = I->Fd;
+      Fds[N].events = POLLIN;
+      Owners.push_back(I);
+   }
+   Fds[N].fd = InFd;
+   Fds[N].events = POLLIN;
+
+   if (poll(&Fds[0], Fds.size(), -1) < 0)
+      return;
+
+   for (N = 0; N != Owners.size(); N++)
+   {
+      if (Fds[N].revents == 0)
+	 continue;
+
+      list<Signer>::iterator I = Owners[N];
+      char buffer[4096];
+      int Res = read(I->Fd, buffer, sizeof(buffer));
+      if (Res < 0 && (errno == EINTR || errno == EAGAIN))
+	 continue;
+      if (Res > 0)
+      {
+	 I->Output.append(buffer, Res);
+	 continue;
+      }
+
+      // GPG closed its side, collect the result
+      int status;
+      close(I->Fd);
+      while (waitpid(I->Pid, &status, 0) < 0 && errno == EINTR);
+
+      // Without gpgv every signature is left to gpg itself
+      if (I->Snapshot == true && WIFEXITED(status) != 0 &&
+	  WEXITSTATUS(status) == 111)
+      {
+	 Keyring = "";
+	 for (list<Signer>::iterator W = Waiting.begin();
+	      W != Waiting.end(); W++)
+	    W->Snapshot = false;
+	 Signer S = *I;
+	 S.Snapshot = false;
+	 S.Output = "";
+	 Waiting.push_front(S);
+	 Running.erase(I);
+	 continue;
+      }
+
+      Job *J = I->Owner;
+      unsigned int Slot = (I->Sig == 0 ? 0 : I->Sig-1);
+      const char *msg = getFileSigner(I->Output, status, J->KeyIDs[Slot]);
+      if (msg != NULL)
+	 J->Errors[Slot] = msg;
+      J->Pending--;
+      Running.erase(I);
+   }
+}
+
+/*
+ * Finish - Complete a job whose gpg runs are all done.
+ */
+bool GPGMethod::Finish(Job *J)
+{
+   if (J->TempDir.empty() == false)
+      removeTmpDir(J->TempDir, J->SigCount);
+
+   // The first failing signature decides, like a serial check would
+   string KeyList;
+   for (unsigned int I = 0; I != J->Errors.size(); I++)
+   {
+      if (J->Errors[I].empty() == false)
+	 return _error->Error("%s", J->Errors[I].c_str());
+      if (KeyList.empty())
+	 KeyList = J->KeyIDs[I];
+      else
+	 KeyList = KeyList+","+J->KeyIDs[I];
+   }
+
+   FetchResult Res;
+   Res.Filename = J->Itm->DestFile;
+   URIStart(Res);
    
    // Transfer the modification times
    struct stat Buf;
-   if (stat(Path.c_str(),&Buf) != 0)
-      return _error->Errno("stat","Failed to stat %s", Path.c_str());
+   if (stat(J->Path.c_str(),&Buf) != 0)
+      return _error->Errno("stat","Failed to stat %s", J->Path.c_str());
    
    struct utimbuf TimeBuf;
    TimeBuf.actime = Buf.st_atime;
    TimeBuf.modtime = Buf.st_mtime;
-   if (utime(Itm->DestFile.c_str(),&TimeBuf) != 0)
+   if (utime(J->Itm->DestFile.c_str(),&TimeBuf) != 0)
       return _error->Errno("utime","Failed to set modification time");
    
-   if (stat(Itm->DestFile.c_str(),&Buf) != 0)
-      return _error->Errno("stat","Failed to stat %s", Itm->DestFile.c_str());
+   if (stat(J->Itm->DestFile.c_str(),&Buf) != 0)
+      return _error->Errno("stat","Failed to stat %s",
+			   J->Itm->DestFile.c_str());
    
    // Return a Done response
    Res.LastModified = Buf.st_mtime;
@@ -427,6 +784,111 @@ bool GPGMethod::Fetch(FetchItem *Itm)
    return true;
 }
 
+/*
+ * Report - Answer the jobs at the front of the queue which are done.
+ */
+void GPGMethod::Report()
+{
+   while (Jobs.empty() == false && Jobs.front()->Pending == 0)
+   {
+      Job *J = Jobs.front();
+      Jobs.pop_front();
+      if (Finish(J) == false)
+	 Fail();
+      delete J;
+   }
+}
+
+/*
+ * Fetch - Queue the verification of a signed file. The gpg runs of
+ *         several files overlap, up to Acquire::gpg::Parallel of them;
+ *         once APT has nothing more queued for us we wait for them.
+ */
+bool GPGMethod::Fetch(FetchItem *Itm)
+{
+   if (MaxRunning == 0)
+   {
+      int Max = _config->FindI("Acquire::gpg::Parallel",4);
+      MaxRunning = (Max < 1 ? 1 : Max);
+   }
+
+   // Only done once, the method stays around for the whole acquire run
+   if (TriedKeyring == false &&
+       _config->FindB("Acquire::gpg::Keyring-Snapshot",true) == true &&
+       SnapshotKeyring() == false)
+   {
+      string Err;
+      _error->PopMessage(Err);
+      _error->Discard();
+      Log("%s, checking with gpg", Err.c_str());
+   }
+
+   URI Get = Itm->Uri;
+   Job *J = new Job;
+   J->Itm = Itm;
+   J->Path = Get.Host + Get.Path; // To account for relative paths
+   J->OldStyle = true;
+   J->SigCount = 0;
+   J->Pending = 0;
+   Jobs.push_back(J);
+
+   // Errors are kept with the job, the items before it are answered first
+   if (Prepare(J) == false)
+   {
+      string Err = "Undetermined Error";
+      _error->PopMessage(Err);
+      _error->Discard();
+      if (J->TempDir.empty() == false)
+	 removeTmpDir(J->TempDir, J->SigCount);
+      J->TempDir = "";
+      J->SigCount = 0;
+      J->KeyIDs.resize(1);
+      J->Errors.resize(1);
+      J->Errors[0] = Err;
+      J->Pending = 0;
+   }
+
+   StartSigners();
+   while (1)
+   {
+      Report();
+      if (Jobs.empty() == true || MoreQueued() == true)
+	 break;
+      WaitSigners();
+      StartSigners();
+   }
+   return true;
+}
+
+/*
+ * Exit - APT went away, stop the gpg runs and clean up.
+ */
+void GPGMethod::Exit()
+{
+   for (list<Signer>::iterator I = Running.begin(); I != Running.end(); I++)
+   {
+      close(I->Fd);
+      kill(I->Pid, SIGTERM);
+      waitpid(I->Pid, NULL, 0);
+   }
+   Running.clear();
+   Waiting.clear();
+
+   for (list<Job *>::iterator I = Jobs.begin(); I != Jobs.end(); I++)
+   {
+      if ((*I)->TempDir.empty() == false)
+	 removeTmpDir((*I)->TempDir, (*I)->SigCount);
+      delete *I;
+   }
+   Jobs.clear();
+
+   if (KeyDir.empty() == false)
+   {
+      unlink((KeyDir+"/pubring.gpg").c_str());
+      rmdir(KeyDir.c_str());
+   }
+}
+
 
 int main()
 {
@@ -59,7 +59,10 @@ using namespace std;
 string HttpMethod::FailFile;
 int HttpMethod::FailFd = -1;
 time_t HttpMethod::FailTime = 0;
+off_t HttpMethod::FailTruncate = -1;
 unsigned long PipelineDepth = 10;
+unsigned long SegmentThreshold = 64*1024*1024;
+unsigned long SegmentCount = 4;
 unsigned long TimeOut = 120;
 bool ChokePipe = true;
 bool Debug = false;
@@ -199,6 +202,40 @@ bool CircleBuf::Write(int Fd)
    }
 }
 									/*}}}*/
+// CircleBuf::WriteAt - Write from the buffer into a FD at an offset	/*{{{*/
+// ---------------------------------------------------------------------
+/* This empties the buffer into the FD starting at Pos, which is advanced
+   past the written data. No hashing is done here, the caller has to
+   hash the file once all of its pieces are in place. */
+bool CircleBuf::WriteAt(int Fd,unsigned long &Pos)
+{
+   while (1)
+   {
+      FillOut();
+      
+      // Woops, buffer is empty
+      if (OutP == InP)
+	 return true;
+      
+      if (OutP == MaxGet)
+	 return true;
+      
+      // Write the buffer segment
+      int Res;
+      Res = pwrite(Fd,Buf + (OutP%Size),LeftWrite(),Pos);
+
+      if (Res <= 0)
+      {
+	 if (Res < 0 && errno == EINTR)
+	    continue;
+	 return false;
+      }
+      
+      Pos += Res;
+      OutP += Res;
+   }
+}
+									/*}}}*/
 // CircleBuf::WriteTillEl - Write from the buffer to a string		/*{{{*/
 // ---------------------------------------------------------------------
 /* This copies till the first empty line */
@@ -628,8 +665,10 @@ bool ServerState::HeaderLine(string Line)
 
 // HttpMethod::SendReq - Send the HTTP request				/*{{{*/
 // ---------------------------------------------------------------------
-/* This places the http request in the outbound buffer */
-void HttpMethod::SendReq(FetchItem *Itm,CircleBuf &Out)
+/* This places the http request in the outbound buffer. If Last is given
+   only the bytes First to Last (inclusive) are requested. */
+void HttpMethod::SendReq(FetchItem *Itm,CircleBuf &Out,unsigned long First,
+			 unsigned long Last)
 {
    URI Uri = Itm->Uri;
 
@@ -681,7 +720,13 @@ void HttpMethod::SendReq(FetchItem *Itm,CircleBuf &Out)
 
    // Check for a partial file
    struct stat SBuf;
-   if (stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
+   if (Last != 0)
+   {
+      // One segment of a segmented download
+      sprintf(Buf,"Range: bytes=%lu-%lu\r\n",First,Last);
+      Req += Buf;
+   }
+   else if (stat(Itm->DestFile.c_str(),&SBuf) >= 0 && SBuf.st_size > 0)
    {
       // In this case we send an if-range query with a range header
       sprintf(Buf,"Range: bytes=%li-\r\nIf-Range: %s\r\n",(long)SBuf.st_size - 1,
@@ -1075,6 +1120,10 @@ void HttpMethod::SigTerm(int)
 {
    if (FailFd == -1)
       _exit(100);
+
+   // Segmented files can only be resumed from their complete head
+   if (FailTruncate >= 0)
+      ftruncate(FailFd,FailTruncate);
    close(FailFd);
    
    // Timestamp
@@ -1119,6 +1168,10 @@ bool HttpMethod::Fetch(FetchItem *)
 	 break;
       }
 
+      // Segmented downloads use their own connections
+      if (Segmented(I) == true)
+	 break;
+
       if (QueueBack == I)
 	 Tail = true;
       if (Tail == true)
@@ -1143,11 +1196,236 @@ bool HttpMethod::Configuration(string Message)
    TimeOut = _config->FindI("Acquire::http::Timeout",TimeOut);
    PipelineDepth = _config->FindI("Acquire::http::Pipeline-Depth",
 				  PipelineDepth);
+   SegmentThreshold = _config->FindI("Acquire::http::Segment-Threshold",
+				     SegmentThreshold);
+   SegmentCount = _config->FindI("Acquire::http::Segments",SegmentCount);
    Debug = _config->FindB("Debug::Acquire::http",false);
    
    return true;
 }
 									/*}}}*/
+// HttpMethod::Segmented - Check if an item is fetched in segments	/*{{{*/
+// ---------------------------------------------------------------------
+/* Only archives of a known size above the threshold are split, partial
+   files are resumed with the plain single request. */
+bool HttpMethod::Segmented(FetchItem *Itm)
+{
+   if (SegmentCount < 2 || SegmentThreshold == 0 || Itm->IndexFile == true ||
+       Itm->ExpectedSize < SegmentThreshold || 
+       Itm->ExpectedSize < SegmentCount)
+      return false;
+
+   struct stat SBuf;
+   if (stat(Itm->DestFile.c_str(),&SBuf) == 0 && SBuf.st_size > 0)
+      return false;
+
+   // Hosts that ignored a range request before get a single connection
+   URI Uri = Itm->Uri;
+   return find(NoRangeHosts.begin(),NoRangeHosts.end(),Uri.Host) == 
+          NoRangeHosts.end();
+}
+									/*}}}*/
+// HttpMethod::FetchSegments - Fetch the head item in segments		/*{{{*/
+// ---------------------------------------------------------------------
+/* The file is split into equal ranges which are requested over separate
+   connections at once. Returns 0 if the item was completed (or failed)
+   and 1 if the server did not honour the ranges, in which case the item
+   is left for the normal single connection path. */
+int HttpMethod::FetchSegments()
+{
+   unsigned long Size = Queue->ExpectedSize;
+   unsigned long Chunk = Size/SegmentCount;
+   vector<Segment> Segs;
+   for (unsigned long I = 0; I != SegmentCount; I++)
+   {
+      Segment S;
+      S.Srv = new ServerState(Queue->Uri,this);
+      S.Pos = I*Chunk;
+      S.End = (I + 1 == SegmentCount)?Size:S.Pos + Chunk;
+      Segs.push_back(S);
+   }
+
+   // Send all of the requests before waiting on any of the replies
+   bool Ok = true;
+   for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+   {
+      if (I->Srv->Open() == false)
+      {
+	 Ok = false;
+	 break;
+      }
+      SendReq(Queue,I->Srv->Out,I->Pos,I->End - 1);
+      I->Srv->Out.Write(I->Srv->ServerFd);
+   }
+
+   // Every segment must come back as the exact range that was asked for
+   for (vector<Segment>::iterator I = Segs.begin(); 
+	Ok == true && I != Segs.end(); I++)
+   {
+      ServerState *Srv = I->Srv;
+      if (Srv->RunHeaders() != 0)
+	 Ok = false;
+      else if (Srv->Result != 206 || (unsigned)Srv->StartPos != I->Pos ||
+	       (I->Pos != 0 && Srv->Size != Size) || 
+	       Srv->Encoding == ServerState::Chunked)
+      {
+	 if (Srv->Result == 200)
+	    NoRangeHosts.push_back(Srv->ServerName.Host);
+	 Ok = false;
+      }
+   }
+
+   if (Ok == false)
+   {
+      for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+	 delete I->Srv;
+      _error->Discard();
+      Queue->ExpectedSize = 0;
+      return 1;
+   }
+
+   FetchResult Res;
+   Res.Filename = Queue->DestFile;
+   Res.Size = Size;
+   Res.LastModified = Segs[0].Srv->Date;
+
+   delete File;
+   File = new FileFd(Queue->DestFile,FileFd::WriteEmpty);
+   if (_error->PendingError() == true)
+   {
+      for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+	 delete I->Srv;
+      delete File;
+      File = 0;
+      Fail();
+      return 0;
+   }
+
+   FailFile = Queue->DestFile;
+   FailFile.c_str();   // Make sure we dont do a malloc in the signal handler
+   FailTruncate = 0;
+   FailFd = File->Fd();
+   FailTime = Res.LastModified;
+
+   URIStart(Res);
+   bool Result = RunSegments(Segs);
+   for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+      delete I->Srv;
+
+   // Cut the file back to what can be resumed by a plain request
+   if (Result == false && ftruncate(File->Fd(),FailTruncate) != 0)
+      _error->Errno("ftruncate",_("Error writing to the file"));
+
+   Hashes Hash;
+   if (Result == true)
+   {
+      lseek(File->Fd(),0,SEEK_SET);
+      if (Hash.AddFD(File->Fd(),Size) == false)
+	 Result = _error->Errno("read",_("Problem hashing file"));
+   }
+
+   // Close the file, destroy the FD object and timestamp it
+   FailFd = -1;
+   FailTruncate = -1;
+   delete File;
+   File = 0;
+
+   struct utimbuf UBuf;
+   UBuf.actime = Res.LastModified;
+   UBuf.modtime = Res.LastModified;
+   utime(Queue->DestFile.c_str(),&UBuf);
+
+   if (Result == true)
+   {
+      Res.TakeHashes(Hash);
+      URIDone(Res);
+   }
+   else
+      Fail(true);
+   return 0;
+}
+									/*}}}*/
+// HttpMethod::RunSegments - Transfer the data of all segments		/*{{{*/
+// ---------------------------------------------------------------------
+/* All segments are read in a single select loop, each one writing its
+   data at its own offset in the file. FailTruncate follows the length
+   of the complete head of the file. */
+bool HttpMethod::RunSegments(vector<Segment> &Segs)
+{
+   for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+   {
+      I->Srv->State = ServerState::Data;
+      I->Srv->In.Limit(I->End - I->Pos);
+   }
+
+   while (1)
+   {
+      // Move the buffered data to the file
+      bool Done = true;
+      bool Head = true;
+      for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+      {
+	 if (I->Srv->In.WriteAt(File->Fd(),I->Pos) == false)
+	    return _error->Errno("write",_("Error writing to output file"));
+	 if (Head == true)
+	    FailTruncate = I->Pos;
+	 if (I->Pos == I->End)
+	    continue;
+	 
+	 Done = false;
+	 Head = false;
+	 if (I->Srv->ServerFd == -1)
+	    return _error->Error(_("Error reading from server Remote end closed connection"));
+      }
+      
+      if (Done == true)
+	 return true;
+
+      fd_set rfds;
+      FD_ZERO(&rfds);
+      FD_SET(STDIN_FILENO,&rfds);
+      int MaxFd = STDIN_FILENO;
+      for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+      {
+	 if (I->Pos == I->End || I->Srv->In.ReadSpace() == false)
+	    continue;
+	 FD_SET(I->Srv->ServerFd,&rfds);
+	 if (MaxFd < I->Srv->ServerFd)
+	    MaxFd = I->Srv->ServerFd;
+      }
+
+      struct timeval tv;
+      tv.tv_sec = TimeOut;
+      tv.tv_usec = 0;
+      int Res = 0;
+      if ((Res = select(MaxFd+1,&rfds,0,0,&tv)) < 0)
+      {
+	 if (errno == EINTR)
+	    continue;
+	 return _error->Errno("select",_("Select failed"));
+      }
+      
+      if (Res == 0)
+	 return _error->Error(_("Connection timed out"));
+
+      // A closed connection is fine as long as its data is all in
+      for (vector<Segment>::iterator I = Segs.begin(); I != Segs.end(); I++)
+      {
+	 if (I->Pos == I->End || FD_ISSET(I->Srv->ServerFd,&rfds) == 0)
+	    continue;
+	 if (I->Srv->In.Read(I->Srv->ServerFd) == false)
+	    I->Srv->Close();
+      }
+
+      // Handle commands from APT
+      if (FD_ISSET(STDIN_FILENO,&rfds))
+      {
+	 if (Run(true) != -1)
+	    exit(100);
+      }
+   }
+}
+									/*}}}*/
 // HttpMethod::Loop - Main loop						/*{{{*/
 // ---------------------------------------------------------------------
 /* */
@@ -1200,6 +1478,14 @@ int HttpMethod::Loop()
       // Reset the pipeline
       if (Server->ServerFd == -1)
 	 QueueBack = Queue;	 
+
+      // Large archives are fetched over several ranged connections
+      if (QueueBack == Queue && Segmented(Queue) == true &&
+	  FetchSegments() == 0)
+      {
+	 FailCounter = 0;
+	 continue;
+      }
 	 
       // Connnect to the host
       if (Server->Open() == false)
@@ -60,6 +60,7 @@ class CircleBuf
    
    // Write data out
    bool Write(int Fd);
+   bool WriteAt(int Fd,unsigned long &Pos);
    bool WriteTillEl(string &Data,bool Single = false);
    
    // Control the write limit
@@ -135,11 +136,23 @@ class HttpMethod : public pkgAcqMethod
       vector <string *> AuthURIs;
    };
 
-   void SendReq(FetchItem *Itm,CircleBuf &Out);
+   // One ranged connection of a segmented download
+   struct Segment
+   {
+      ServerState *Srv;
+      unsigned long Pos;
+      unsigned long End;
+   };
+
+   void SendReq(FetchItem *Itm,CircleBuf &Out,unsigned long First = 0,
+		unsigned long Last = 0);
    bool Go(bool ToFile,ServerState *Srv);
    bool Flush(ServerState *Srv);
    bool ServerDie(ServerState *Srv);
    int DealWithHeaders(FetchResult &Res,ServerState *Srv);
+   bool Segmented(FetchItem *Itm);
+   int FetchSegments();
+   bool RunSegments(vector<Segment> &Segs);
 
    virtual bool Fetch(FetchItem *);
    virtual bool Configuration(string Message);
@@ -148,10 +161,12 @@ class HttpMethod : public pkgAcqMethod
    static string FailFile;
    static int FailFd;
    static time_t FailTime;
+   static off_t FailTruncate;
    static void SigTerm(int);
 
    string NextURI;
    vector<AuthRec> AuthList;
+   vector<string> NoRangeHosts;
    
    public:
    friend class ServerState;